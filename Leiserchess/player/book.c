@@ -0,0 +1,180 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Opening book.  The book file is memory-mapped rather than read, so opening
+// even a large book costs next to nothing, and only the pages that a lookup
+// touches are ever read from disk.  A lookup is a binary search on the key.
+
+#include "./book.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./fen.h"
+#include "./util.h"
+
+int OWN_BOOK;  // Play moves from the book
+
+static void *book_map = NULL;   // the mapped book file, or NULL
+static size_t book_map_size = 0;
+static const book_entry_t *book = NULL;  // its entries
+static int64_t book_size = 0;
+
+// Books store Zobrist keys, which depend on the random numbers of init_zob().
+// A book made with other keys is useless, and this is how to tell.
+static uint64_t start_key() {
+  position_t p;
+  fen_to_pos(&p, "");
+  return p.key;
+}
+
+// Opens the book in filename, in place of the current one.  Returns its
+// number of entries, or -1 if it cannot be used.
+int64_t book_open(const char *filename) {
+  book_close();
+
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat sbuf;
+  if (fstat(fd, &sbuf) != 0 || sbuf.st_size < sizeof(book_header_t)) {
+    close(fd);
+    return -1;
+  }
+  void *map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  // The entries must fill the rest of the file exactly.  num_entries is
+  // compared with what fits, rather than multiplied out, so that a corrupt
+  // count cannot wrap around to the right size.
+  const book_header_t *header = (const book_header_t *) map;
+  uint64_t entries_size = sbuf.st_size - sizeof(book_header_t);
+  if (memcmp(header->magic, BOOK_MAGIC, sizeof(header->magic)) != 0 ||
+      header->start_key != start_key() ||
+      entries_size % sizeof(book_entry_t) != 0 ||
+      header->num_entries != entries_size / sizeof(book_entry_t)) {
+    munmap(map, sbuf.st_size);
+    return -1;
+  }
+
+  book_map = map;
+  book_map_size = sbuf.st_size;
+  book = (const book_entry_t *) (header + 1);
+  book_size = header->num_entries;
+  return book_size;
+}
+
+void book_close() {
+  if (book_map != NULL) {
+    munmap(book_map, book_map_size);
+  }
+  book_map = NULL;
+  book_map_size = 0;
+  book = NULL;
+  book_size = 0;
+}
+
+int64_t book_num_entries() {
+  return book_size;
+}
+
+// Whether mv can be played on p.  A book is only keyed by the board and the
+// side to move, so its moves can still break the Ko rule.
+static bool book_move_is_legal(position_t *p, move_t mv) {
+  if (!is_pseudo_legal(p, mv)) {
+    return false;
+  }
+  position_t next;
+  victims_t victims = make_move(p, &next, mv);
+  return !is_KO(victims) && !is_ILLEGAL(victims);
+}
+
+// Returns a book move for p, or 0 if the book has none.  The legal moves of
+// the position are picked at random in proportion to their weights.
+move_t book_probe(position_t *p) {
+  // the first entry with key p->key or greater
+  int64_t lo = 0;
+  int64_t hi = book_size;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (book[mid].key < p->key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  uint64_t total = 0;
+  int64_t end = lo;
+  for (; end < book_size && book[end].key == p->key; end++) {
+    if (book_move_is_legal(p, book[end].move)) {
+      total += book[end].weight;
+    }
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint64_t r = myrand() % total;
+  for (int64_t i = lo; i < end; i++) {
+    if (book_move_is_legal(p, book[i].move)) {
+      if (r < book[i].weight) {
+        return book[i].move;
+      }
+      r -= book[i].weight;
+    }
+  }
+  return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const book_entry_t *x = (const book_entry_t *) a;
+  const book_entry_t *y = (const book_entry_t *) b;
+  if (x->key != y->key) {
+    return x->key < y->key ? -1 : 1;
+  }
+  if (x->move != y->move) {
+    return x->move < y->move ? -1 : 1;
+  }
+  return 0;
+}
+
+// Writes the n entries as a book to filename.  Sorts them and merges the ones
+// for the same move of the same position, adding up their weights.  Returns
+// the number of entries written, or -1 on error.
+int64_t book_write(const char *filename, book_entry_t *entries, int64_t n) {
+  qsort(entries, n, sizeof(book_entry_t), compare_entries);
+  int64_t m = 0;
+  for (int64_t i = 0; i < n; i++) {
+    if (m > 0 && compare_entries(&entries[m - 1], &entries[i]) == 0) {
+      entries[m - 1].weight += entries[i].weight;
+    } else {
+      entries[m++] = entries[i];
+    }
+  }
+
+  book_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BOOK_MAGIC, sizeof(BOOK_MAGIC));
+  header.start_key = start_key();
+  header.num_entries = m;
+
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL) {
+    return -1;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+      fwrite(entries, sizeof(book_entry_t), m, f) == (size_t) m;
+  if (fclose(f) != 0 || !ok) {
+    return -1;
+  }
+  return m;
+}
@@ -0,0 +1,38 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "./move_gen.h"
+
+// The engine opens this book at startup, if it is there (see leiserchess.c).
+#define BOOK_FILE "leiserchess.book"
+
+#define BOOK_MAGIC "LCBOOK1"
+
+// An opening book file is a book_header_t followed by num_entries entries,
+// sorted by key and then by move, in the byte order of the machine that wrote
+// it.  A position has one entry for each book move, weighted by how often the
+// lines that made the book played it.
+typedef struct book_header {
+  char     magic[8];     // BOOK_MAGIC
+  uint64_t start_key;    // key of the opening position when it was written
+  uint64_t num_entries;
+} book_header_t;
+
+typedef struct book_entry {
+  uint64_t key;     // Zobrist key of the position
+  move_t   move;
+  uint32_t weight;
+} book_entry_t;
+
+int64_t book_open(const char *filename);
+void book_close();
+int64_t book_num_entries();
+move_t book_probe(position_t *p);
+int64_t book_write(const char *filename, book_entry_t *entries, int64_t n);
+
+#endif  // BOOK_H
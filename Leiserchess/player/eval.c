@@ -4,7 +4,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include "./eval_tables.h"
 #include "./move_gen.h"
 #include "./tbassert.h"
 
@@ -31,12 +31,8 @@ int PAWNPIN;
 
 // PCENTRAL heuristic: Bonus for Pawn near center of board
 ev_score_t pcentral(fil_t f, rnk_t r) {
-  double df = BOARD_WIDTH/2 - f - 1;
-  if (df < 0)  df = f - BOARD_WIDTH/2;
-  double dr = BOARD_WIDTH/2 - r - 1;
-  if (dr < 0) dr = r - BOARD_WIDTH/2;
-  double bonus = 1 - sqrt(df * df + dr * dr) / (BOARD_WIDTH / sqrt(2));
-  return PCENTRAL * bonus;
+  int bonus = pcentral_table[bb_index(square_of(f, r))];
+  return (PCENTRAL * bonus) / PCENTRAL_ONE;
 }
 
 
@@ -54,6 +50,21 @@ ev_score_t pbetween(position_t *p, fil_t f, rnk_t r) {
   return is_between ? PBETWEEN : 0;
 }
 
+// Squares on files a..b, and on ranks a..b, for a <= b
+static bitboard_t fil_span[BOARD_WIDTH][BOARD_WIDTH];
+static bitboard_t rnk_span[BOARD_WIDTH][BOARD_WIDTH];
+
+// The rectangle defined by the Kings at the corners, as a bitboard: a Pawn
+// gets the PBETWEEN bonus if and only if it is on one of these squares.
+static bitboard_t between_kings(position_t *p) {
+  fil_t wf = fil_of(p->kloc[WHITE]);
+  fil_t bf = fil_of(p->kloc[BLACK]);
+  rnk_t wr = rnk_of(p->kloc[WHITE]);
+  rnk_t br = rnk_of(p->kloc[BLACK]);
+  return (wf < bf ? fil_span[wf][bf] : fil_span[bf][wf]) &
+      (wr < br ? rnk_span[wr][br] : rnk_span[br][wr]);
+}
+
 
 // KFACE heuristic: bonus (or penalty) for King facing toward the other King
 ev_score_t kface(position_t *p, fil_t f, rnk_t r) {
@@ -119,104 +130,19 @@ ev_score_t kaggressive(position_t *p, fil_t f, rnk_t r) {
   return (KAGGRESSIVE * bonus) / (BOARD_WIDTH * BOARD_WIDTH);
 }
 
-// Marks the path/line-of-sight of the laser until it hits a piece or goes off
-// the board.
-//
-// p : Current board state.
-// c : Color of king shooting laser.
-// laser_map : End result will be stored here. Every square on the
-//             path of the laser is marked with mark_mask.
-// mark_mask : What each square is marked with.
-void mark_laser_path(position_t *p, color_t c, char *laser_map,
-                     char mark_mask) {
-  square_t sq = p->kloc[c];
-  int bdir = ori_of(p->board[sq]);
-
-  tbassert(ptype_of(p->board[sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[sq]));
-  laser_map[sq] |= mark_mask;
-
-  while (true) {
-    sq += beam_of(bdir);
-    laser_map[sq] |= mark_mask;
-    tbassert(sq < ARR_SIZE && sq >= 0, "sq: %d\n", sq);
-
-    switch (ptype_of(p->board[sq])) {
-      case EMPTY:  // empty square
-        break;
-      case PAWN:  // Pawn
-        bdir = reflect_of(bdir, ori_of(p->board[sq]));
-        if (bdir < 0) {  // Hit back of Pawn
-          return;
-        }
-        break;
-      case KING:  // King
-        return;  // sorry, game over my friend!
-        break;
-      case INVALID:  // Ran off edge of board
-        return;
-        break;
-      default:  // Shouldna happen, man!
-        tbassert(false, "Not cool, man.  Not cool.\n");
-        break;
-    }
-  }
-}
-
 // PAWNPIN Heuristic: count number of pawns that are not pinned by the
 //   opposing king's laser --- and are thus mobile.
-
-int pawnpin(position_t *p, color_t color) {
-  color_t c = opp_color(color);
-  char laser_map[ARR_SIZE];
-
-  for (int i = 0; i < ARR_SIZE; ++i) {
-    laser_map[i] = 4;   // Invalid square
-  }
-
-  for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      laser_map[square_of(f, r)] = 0;
-    }
-  }
-
-  mark_laser_path(p, c, laser_map, 1);  // find path of laser given that you aren't moving
-
-
-
-  int unpinned_pawns = 0;
-
-  // Figure out which pawns are not pinned down by the laser.
-  for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      if (laser_map[square_of(f, r)] == 0 &&
-          color_of(p->board[square_of(f, r)]) == color &&
-          ptype_of(p->board[square_of(f, r)]) == PAWN) {
-        unpinned_pawns += 1;
-      }
-    }
-  }
-
-  return unpinned_pawns;
+//
+// opp_laser : path of the opposing king's laser, as from laser_path()
+int pawnpin(position_t *p, color_t color, bitboard_t opp_laser) {
+  bitboard_t pawns = p->bb_color[color] & p->bb_ptype[PAWN];
+  return bb_popcount(pawns & ~opp_laser);
 }
 
 // MOBILITY heuristic: safe squares around king of given color.
-int mobility(position_t *p, color_t color) {
-  color_t c = opp_color(color);
-  char laser_map[ARR_SIZE];
-
-  for (int i = 0; i < ARR_SIZE; ++i) {
-    laser_map[i] = 4;   // Invalid square
-  }
-
-  for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      laser_map[square_of(f, r)] = 0;
-    }
-  }
-
-  mark_laser_path(p, c, laser_map, 1);  // find path of laser given that you aren't moving
-
+//
+// opp_laser : path of the opposing king's laser, as from laser_path()
+int mobility(position_t *p, color_t color, bitboard_t opp_laser) {
   int mobility = 0;
   square_t king_sq = p->kloc[color];
   tbassert(ptype_of(p->board[king_sq]) == KING,
@@ -224,12 +150,12 @@ int mobility(position_t *p, color_t color) {
   tbassert(color_of(p->board[king_sq]) == color,
            "color: %d\n", color_of(p->board[king_sq]));
 
-  if (laser_map[king_sq] == 0) {
+  if (!(opp_laser & bb_of(king_sq))) {
     mobility++;
   }
   for (int d = 0; d < 8; ++d) {
     square_t sq = king_sq + dir_of(d);
-    if (laser_map[sq] == 0) {
+    if (ptype_of(p->board[sq]) != INVALID && !(opp_laser & bb_of(sq))) {
       mobility++;
     }
   }
@@ -237,49 +163,58 @@ int mobility(position_t *p, color_t color) {
 }
 
 
-// Harmonic-ish distance: 1/(|dx|+1) + 1/(|dy|+1)
-float h_dist(square_t a, square_t b) {
-  //  printf("a = %d, FIL(a) = %d, RNK(a) = %d\n", a, FIL(a), RNK(a));
-  //  printf("b = %d, FIL(b) = %d, RNK(b) = %d\n", b, FIL(b), RNK(b));
-  int delta_fil = abs(fil_of(a) - fil_of(b));
-  int delta_rnk = abs(rnk_of(a) - rnk_of(b));
-  float x = (1.0 / (delta_fil + 1)) + (1.0 / (delta_rnk + 1));
-  //  printf("max_dist = %d\n\n", x);
-  return x;
+// Harmonic-ish distance: 1/(|dx|+1) + 1/(|dy|+1), in units of 1/H_DIST_ONE
+int h_dist(square_t a, square_t b) {
+  return h_dist_table[bb_index(a)][bb_index(b)];
 }
 
 // H_SQUARES_ATTACKABLE heuristic: for shooting the enemy king
-int h_squares_attackable(position_t *p, color_t c) {
-  char laser_map[ARR_SIZE];
-
-  for (int i = 0; i < ARR_SIZE; ++i) {
-    laser_map[i] = 4;   // Invalid square
-  }
-
-  for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      laser_map[square_of(f, r)] = 0;
-    }
-  }
-
-  mark_laser_path(p, c, laser_map, 1);  // 1 = path of laser with no moves
-
+//
+// laser : path of the laser of the king of color c, as from laser_path()
+int h_squares_attackable(position_t *p, color_t c, bitboard_t laser) {
   square_t o_king_sq = p->kloc[opp_color(c)];
   tbassert(ptype_of(p->board[o_king_sq]) == KING,
            "ptype: %d\n", ptype_of(p->board[o_king_sq]));
   tbassert(color_of(p->board[o_king_sq]) != c,
            "color: %d\n", color_of(p->board[o_king_sq]));
 
-  float h_attackable = 0;
+  // The distances to the enemy King of all squares, exact in fixed point
+  const uint16_t *dist = h_dist_table[bb_index(o_king_sq)];
+  int h_attackable = 0;
+  for (; laser; laser &= laser - 1) {
+    h_attackable += dist[bb_lsb(laser)];
+  }
+  return h_attackable / H_DIST_ONE;
+}
+
+int32_t pawn_square_ev[BB_SIZE];
+
+// Fills in the tables of the static evaluator.  pawn_square_ev depends on
+// PCENTRAL, so this has to run again whenever that changes; positions then
+// need init_pawn_ev().
+void init_eval_tables() {
   for (fil_t f = 0; f < BOARD_WIDTH; f++) {
     for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
-      square_t sq = square_of(f, r);
-      if (laser_map[sq] != 0) {
-        h_attackable += h_dist(sq, o_king_sq);
+      pawn_square_ev[bb_index(square_of(f, r))] = PAWN_EV_VALUE + pcentral(f, r);
+    }
+  }
+
+  for (int a = 0; a < BOARD_WIDTH; a++) {
+    for (int b = a; b < BOARD_WIDTH; b++) {
+      fil_span[a][b] = 0;
+      rnk_span[a][b] = 0;
+      for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+        for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+          if (between(f, a, b)) {
+            fil_span[a][b] |= bb_of(square_of(f, r));
+          }
+          if (between(r, a, b)) {
+            rnk_span[a][b] |= bb_of(square_of(f, r));
+          }
+        }
       }
     }
   }
-  return h_attackable;
 }
 
 // Static evaluation.  Returns score
@@ -293,93 +228,95 @@ score_t eval(position_t *p, bool verbose) {
   ev_score_t bonus;
   char buf[MAX_CHARS_IN_MOVE];
 
-  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
-      square_t sq = square_of(f, r);
-      piece_t x = p->board[sq];
-      color_t c = color_of(x);
-      if (verbose) {
-        square_to_str(sq, buf, MAX_CHARS_IN_MOVE);
-      }
-
-      switch (ptype_of(x)) {
-        case EMPTY:
-          break;
-        case PAWN:
-          // MATERIAL heuristic: Bonus for each Pawn
-          bonus = PAWN_EV_VALUE;
-          if (verbose) {
-            printf("MATERIAL bonus %d for %s Pawn on %s\n", bonus, color_to_str(c), buf);
-          }
-          score[c] += bonus;
+  if (verbose) {
+    // Go through the Pawns one by one to show where the bonuses come from
+    for (bitboard_t pawns = p->bb_ptype[PAWN]; pawns; pawns &= pawns - 1) {
+      square_t sq = bb_square(bb_lsb(pawns));
+      fil_t f = fil_of(sq);
+      rnk_t r = rnk_of(sq);
+      color_t c = color_of(p->board[sq]);
+      square_to_str(sq, buf, MAX_CHARS_IN_MOVE);
+
+      // MATERIAL heuristic: Bonus for each Pawn
+      bonus = PAWN_EV_VALUE;
+      printf("MATERIAL bonus %d for %s Pawn on %s\n", bonus, color_to_str(c), buf);
+      score[c] += bonus;
+
+      // PBETWEEN heuristic
+      bonus = pbetween(p, f, r);
+      printf("PBETWEEN bonus %d for %s Pawn on %s\n", bonus, color_to_str(c), buf);
+      score[c] += bonus;
+
+      // PCENTRAL heuristic
+      bonus = pcentral(f, r);
+      printf("PCENTRAL bonus %d for %s Pawn on %s\n", bonus, color_to_str(c), buf);
+      score[c] += bonus;
+    }
+  } else {
+    // The position keeps MATERIAL and PCENTRAL of its Pawns up to date, and
+    // the PBETWEEN Pawns are those in the rectangle of the Kings.
+    bitboard_t rect = between_kings(p);
+    for (color_t c = WHITE; c <= BLACK; c++) {
+      bitboard_t pawns = p->bb_color[c] & p->bb_ptype[PAWN];
+      score[c] += p->pawn_ev[c] + PBETWEEN * bb_popcount(pawns & rect);
+    }
+  }
 
-          // PBETWEEN heuristic
-          bonus = pbetween(p, f, r);
-          if (verbose) {
-            printf("PBETWEEN bonus %d for %s Pawn on %s\n", bonus, color_to_str(c), buf);
-          }
-          score[c] += bonus;
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    square_t sq = p->kloc[c];
+    fil_t f = fil_of(sq);
+    rnk_t r = rnk_of(sq);
+    if (verbose) {
+      square_to_str(sq, buf, MAX_CHARS_IN_MOVE);
+    }
 
-          // PCENTRAL heuristic
-          bonus = pcentral(f, r);
-          if (verbose) {
-            printf("PCENTRAL bonus %d for %s Pawn on %s\n", bonus, color_to_str(c), buf);
-          }
-          score[c] += bonus;
-          break;
-
-        case KING:
-          // KFACE heuristic
-          bonus = kface(p, f, r);
-          if (verbose) {
-            printf("KFACE bonus %d for %s King on %s\n", bonus,
-                   color_to_str(c), buf);
-          }
-          score[c] += bonus;
+    // KFACE heuristic
+    bonus = kface(p, f, r);
+    if (verbose) {
+      printf("KFACE bonus %d for %s King on %s\n", bonus,
+             color_to_str(c), buf);
+    }
+    score[c] += bonus;
 
-          // KAGGRESSIVE heuristic
-          bonus = kaggressive(p, f, r);
-          if (verbose) {
-            printf("KAGGRESSIVE bonus %d for %s King on %s\n", bonus, color_to_str(c), buf);
-          }
-          score[c] += bonus;
-          break;
-        case INVALID:
-          break;
-        default:
-          tbassert(false, "Jose says: no way!\n");   // No way, Jose!
-      }
+    // KAGGRESSIVE heuristic
+    bonus = kaggressive(p, f, r);
+    if (verbose) {
+      printf("KAGGRESSIVE bonus %d for %s King on %s\n", bonus, color_to_str(c), buf);
     }
+    score[c] += bonus;
   }
 
+  // The laser-based heuristics below all share the two laser paths
+  bitboard_t laser[2] = { laser_path(p, WHITE), laser_path(p, BLACK) };
+
   // H_SQUARES_ATTACKABLE heuristic
-  ev_score_t w_hattackable = HATTACK * h_squares_attackable(p, WHITE);
+  ev_score_t w_hattackable = HATTACK * h_squares_attackable(p, WHITE, laser[WHITE]);
   score[WHITE] += w_hattackable;
   if (verbose) {
     printf("HATTACK bonus %d for White\n", w_hattackable);
   }
-  ev_score_t b_hattackable = HATTACK * h_squares_attackable(p, BLACK);
+  ev_score_t b_hattackable = HATTACK * h_squares_attackable(p, BLACK, laser[BLACK]);
   score[BLACK] += b_hattackable;
   if (verbose) {
     printf("HATTACK bonus %d for Black\n", b_hattackable);
   }
 
   // MOBILITY heuristic
-  int w_mobility = MOBILITY * mobility(p, WHITE);
+  int w_mobility = MOBILITY * mobility(p, WHITE, laser[BLACK]);
   score[WHITE] += w_mobility;
   if (verbose) {
     printf("MOBILITY bonus %d for White\n", w_mobility);
   }
-  int b_mobility = MOBILITY * mobility(p, BLACK);
+  int b_mobility = MOBILITY * mobility(p, BLACK, laser[WHITE]);
   score[BLACK] += b_mobility;
   if (verbose) {
     printf("MOBILITY bonus %d for Black\n", b_mobility);
   }
 
   // PAWNPIN heuristic --- is a pawn immobilized by the enemy laser.
-  int w_pawnpin = PAWNPIN * pawnpin(p, WHITE);
+  int w_pawnpin = PAWNPIN * pawnpin(p, WHITE, laser[BLACK]);
   score[WHITE] += w_pawnpin;
-  int b_pawnpin = PAWNPIN * pawnpin(p, BLACK);
+  int b_pawnpin = PAWNPIN * pawnpin(p, BLACK, laser[WHITE]);
   score[BLACK] += b_pawnpin;
 
   // score from WHITE point of view
@@ -13,9 +13,7 @@
 // ev_score_t values
 #define PAWN_EV_VALUE (PAWN_VALUE*EV_SCORE_RATIO)
 
-void mark_laser_path(position_t *p, color_t c, char *laser_map,
-                     char mark_mask);
-
+void init_eval_tables();
 score_t eval(position_t *p, bool verbose);
 
 #endif  // EVAL_H
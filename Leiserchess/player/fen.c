@@ -353,6 +353,7 @@ int fen_to_pos(position_t *p, char *fen) {
   // King check
 
   int Kings[2] = {0, 0};
+  int pawns = 0;
   for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
     for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
       square_t sq = square_of(f, r);
@@ -361,10 +362,21 @@ int fen_to_pos(position_t *p, char *fen) {
       if (typ == KING) {
         Kings[color_of(x)]++;
         p->kloc[color_of(x)] = sq;
+      } else if (typ == PAWN) {
+        pawns++;
       }
     }
   }
 
+  // The laser paths have room for the reflections of MAX_PAWNS Pawns.
+  if (pawns > MAX_PAWNS) {
+    fen_error(fen, c_count, "Too many Pawns");
+    return 1;
+  }
+
+  init_bitboards(p);
+  init_lasers(p);
+
   if (Kings[WHITE] == 0) {
     fen_error(fen, c_count, "No White Kings");
     return 1;
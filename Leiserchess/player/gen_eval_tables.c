@@ -0,0 +1,80 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Generates eval_tables.h, the fixed-point tables of the static evaluator, for
+// the BOARD_WIDTH in move_gen.h.  The Makefile runs it whenever move_gen.h
+// changes, so eval.c never does floating point at search time, and every
+// build of the same board size gets exactly the same scores.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "./move_gen.h"
+
+// Squares are numbered as bit indices (see bb_index in move_gen.h)
+#define FIL(i) ((i) / BOARD_WIDTH)
+#define RNK(i) ((i) % BOARD_WIDTH)
+
+// Scale of pcentral_table: 1.0 is PCENTRAL_ONE
+#define PCENTRAL_ONE (1 << 16)
+
+static int gcd(int a, int b) {
+  while (b != 0) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+int main() {
+  // h_dist adds up fractions 1 / (delta + 1) with delta < BOARD_WIDTH.  Scaled
+  // by the least common multiple of their denominators, they are all exact.
+  int h_dist_one = 1;
+  for (int d = 1; d <= BOARD_WIDTH; d++) {
+    h_dist_one = h_dist_one / gcd(h_dist_one, d) * d;
+  }
+
+  printf("// Generated by gen_eval_tables.c -- do not edit.\n\n");
+  printf("#ifndef EVAL_TABLES_H\n#define EVAL_TABLES_H\n\n");
+  printf("#include \"./move_gen.h\"\n\n");
+  printf("#if BOARD_WIDTH != %d\n", BOARD_WIDTH);
+  printf("#error \"eval_tables.h was generated for another BOARD_WIDTH\"\n");
+  printf("#endif\n\n");
+
+  printf("// 1.0 in h_dist_table\n");
+  printf("#define H_DIST_ONE %d\n\n", h_dist_one);
+  printf("// 1.0 in pcentral_table\n");
+  printf("#define PCENTRAL_ONE %d\n\n", PCENTRAL_ONE);
+
+  printf("// h_dist_table[a][b] = H_DIST_ONE * (1/(|df|+1) + 1/(|dr|+1))\n");
+  printf("static const uint16_t h_dist_table[BB_SIZE][BB_SIZE] = {\n");
+  for (int a = 0; a < BB_SIZE; a++) {
+    printf("  {");
+    for (int b = 0; b < BB_SIZE; b++) {
+      int df = abs(FIL(a) - FIL(b));
+      int dr = abs(RNK(a) - RNK(b));
+      printf("%s%d", b == 0 ? " " : (b % 16 == 0 ? ",\n    " : ", "),
+             h_dist_one / (df + 1) + h_dist_one / (dr + 1));
+    }
+    printf(" },\n");
+  }
+  printf("};\n\n");
+
+  printf("// pcentral_table[i] = PCENTRAL_ONE * (1 - distance to the center / "
+         "(BOARD_WIDTH/sqrt(2)))\n");
+  printf("static const int32_t pcentral_table[BB_SIZE] = {\n");
+  for (int i = 0; i < BB_SIZE; i++) {
+    double df = BOARD_WIDTH/2 - FIL(i) - 1;
+    if (df < 0) df = FIL(i) - BOARD_WIDTH/2;
+    double dr = BOARD_WIDTH/2 - RNK(i) - 1;
+    if (dr < 0) dr = RNK(i) - BOARD_WIDTH/2;
+    double bonus = 1 - sqrt(df * df + dr * dr) / (BOARD_WIDTH / sqrt(2));
+    printf("%s%ld", i == 0 ? "  " : (i % BOARD_WIDTH == 0 ? ",\n  " : ", "),
+           lround(bonus * PCENTRAL_ONE));
+  }
+  printf("\n};\n\n");
+
+  printf("#endif  // EVAL_TABLES_H\n");
+  return 0;
+}
@@ -17,10 +17,13 @@
 #include <cilk/reducer.h>
 #endif
 
+#include "./book.h"
 #include "./eval.h"
 #include "./fen.h"
 #include "./move_gen.h"
 #include "./search.h"
+#include "./stats.h"
+#include "./tablebase.h"
 #include "./tbassert.h"
 #include "./tt.h"
 #include "./util.h"
@@ -31,8 +34,22 @@ char  VERSION[] = "1038";
 #define INF_TIME 99999999999.0
 #define INF_DEPTH 999       // if user does not specify a depth, use 999
 
-// if the time remain is less than this fraction, dont start the next search iteration
-#define RATIO_FOR_TIMEOUT 0.5
+// Time management (see time_for_next_iteration)
+#define TM_ALLOT 0.6               // start no iteration after this times the goal,
+#define TM_UNSTABLE 1.5            // ... this much later after the best move changed,
+#define TM_SCORE_DROP 30           // ... or the score fell by this much,
+#define TM_FALLING 1.5             // ... this much later,
+#define TM_STABLE_ITERATIONS 4     // ... and earlier once the best move held this long
+#define TM_STABLE 0.8
+#define TM_MAX_FINISH 2.5          // and none that would end after this times the goal
+#define TM_MIN_EBF 1.5             // bounds on the effective branching factor
+#define TM_MAX_EBF 8.0
+
+// Aspiration windows: from ASP_DEPTH on, each iteration searches a window of
+// ASP_WINDOW around the score of the last one, widening the side it failed on
+// by twice as much each time.  Mate scores get the full window.
+#define ASP_DEPTH 4
+#define ASP_WINDOW 30
 
 // -----------------------------------------------------------------------------
 // file I/O
@@ -47,11 +64,17 @@ static FILE *IN;
 extern int DRAW;
 extern int LMR_R1;
 extern int LMR_R2;
+extern int LMR_SCALE;
+extern int USE_NULL;
+extern int NULL_R;
+extern int NULL_VERIFY;
 extern int HMB;
 extern int USE_NMM;
 extern int FUT_DEPTH;
 extern int TRACE_MOVES;
 extern int DETECT_DRAWS;
+extern int USE_YBW;
+extern int USE_TB;
 
 // defined in eval.c
 extern int RANDOMIZE;
@@ -70,6 +93,12 @@ extern int USE_KO;
 extern int USE_TT;
 extern int HASH;
 
+// defined in book.c
+extern int OWN_BOOK;
+
+// Search reproducibly (see entry_point)
+int DETERMINISTIC;
+
 // struct for manipulating options below
 typedef struct {
   char      name[MAX_CHARS_IN_TOKEN];   // name of options
@@ -100,13 +129,21 @@ static int_options iopts[] = {
   { "randomize",         &RANDOMIZE,   0,                     0,              PAWN_EV_VALUE },
   { "lmr_r1",               &LMR_R1,   5,                     1,              MAX_NUM_MOVES },
   { "lmr_r2",               &LMR_R2,   20,                    1,              MAX_NUM_MOVES },
+  { "lmr_scale",         &LMR_SCALE,   0,                     0,              200           },
+  { "null_r",               &NULL_R,   2,                     1,              6             },
+  { "null_verify",     &NULL_VERIFY,   6,                     1,              MAX_PLY_IN_SEARCH },
   { "hmb",                     &HMB,   0.03 * PAWN_VALUE,     0,              PAWN_VALUE    },
   { "fut_depth",         &FUT_DEPTH,   3,                     0,              5             },
+  { "ownbook",            &OWN_BOOK,   1,                     0,              1             },
+  { "use_tb",               &USE_TB,   1,                     0,              1             },
+  { "deterministic", &DETERMINISTIC,   0,                     0,              1             },
   // debug options
   { "use_nmm",             &USE_NMM,   1,                     0,              1             },
+  { "use_null",           &USE_NULL,   1,                     0,              1             },
   { "detect_draws",   &DETECT_DRAWS,   1,                     0,              1             },
   { "use_tt",               &USE_TT,   1,                     0,              1             },
   { "use_ko",               &USE_KO,   1,                     0,              1             },
+  { "use_ybw",             &USE_YBW,   1,                     0,              1             },
   { "trace_moves",     &TRACE_MOVES,   0,                     0,              1             },
   { "",                        NULL,   0,                     0,              0             }
 };
@@ -127,15 +164,13 @@ void lower_case(char *s) {
   return;
 }
 
-// Returns victims or NO_VICTIMS if no victims or -1 if illegal move
-// makes the move described by 'mvstring'
-victims_t make_from_string(position_t *old, position_t *p,
-                           const char *mvstring) {
+// Returns the move of p described by 'mvstring', or 0 if there is none
+move_t move_from_string(position_t *p, const char *mvstring) {
   sortable_move_t lst[MAX_NUM_MOVES];
   move_t mv = 0;
   // make copy so that mvstring can be a constant
   char string[MAX_CHARS_IN_MOVE];
-  int move_count = generate_all(old, lst, true);
+  int move_count = generate_all(p, lst, true);
 
   snprintf(string, MAX_CHARS_IN_MOVE, "%s", mvstring);
   lower_case(string);
@@ -150,7 +185,14 @@ victims_t make_from_string(position_t *old, position_t *p,
       break;
     }
   }
+  return mv;
+}
 
+// Returns victims or NO_VICTIMS if no victims or -1 if illegal move
+// makes the move described by 'mvstring'
+victims_t make_from_string(position_t *old, position_t *p,
+                           const char *mvstring) {
+  move_t mv = move_from_string(old, mvstring);
   return (mv == 0) ? ILLEGAL() : make_move(old, p, mv);
 }
 
@@ -166,77 +208,639 @@ typedef enum {
 // -----------------------------------------------------------------------------
 
 static move_t bestMoveSoFar;
+static move_t ponderMoveSoFar;  // the reply expected to bestMoveSoFar, or 0
 static char theMove[MAX_CHARS_IN_MOVE];
 
-static pthread_mutex_t entry_mutex;
-static uint64_t node_count_serial;
+// The killers, history, node count and clock of the search.  The main thread
+// only sets the clock and the stop request while the search is running.
+static search_context_t search_ctx;
+
+// The search runs on a thread of its own, so that the main thread can go on
+// reading commands: stop, ponderhit and isready are answered while the engine
+// is thinking (see doc/engine-interface.txt).
+static pthread_t search_thread;
+static bool search_running = false;  // only used by the main thread
+
+// While pondering, the search runs on the opponent's time, so it has no time
+// limit and does not answer until ponderhit or stop.  ponderhit starts the
+// clock with the goal time that go gave.
+static volatile bool pondering = false;
 
 typedef struct {
   position_t *p;
   int depth;
-  double tme;
+  volatile double tme;
+  int multipv;                        // number of best lines to report
+  int num_searchmoves;                // 0, or how many moves to search
+  move_t searchmoves[MAX_NUM_MOVES];  // the only root moves to search
 } entry_point_args;
 
+static entry_point_args search_args;
+
+// Whether to start another iteration of iterative deepening, given the goal
+// time and the time et spent so far.
+//
+// The time by which to start the iteration depends on how sure the search is
+// about its move: there is more while the best move just changed or the score
+// is falling, and less once the best move has held for a few iterations.
+//
+// Besides, the iteration has to end well before the search aborts (at three
+// times the goal, see init_abort_timer), or it is wasted.  The last iteration
+// took iter_time for nodes nodes, and the one before it last_nodes nodes: the
+// next one is predicted to take as much longer as the last grew over the one
+// before.
+static bool time_for_next_iteration(double goal, double et, double iter_time,
+                                    uint64_t nodes, uint64_t last_nodes,
+                                    int stable_iterations, bool score_dropped) {
+  double allot = goal * TM_ALLOT;
+  if (stable_iterations == 0) {
+    allot *= TM_UNSTABLE;
+  } else if (stable_iterations >= TM_STABLE_ITERATIONS) {
+    allot *= TM_STABLE;
+  }
+  if (score_dropped) {
+    allot *= TM_FALLING;
+  }
+
+  double ebf = last_nodes > 0 ? (double) nodes / last_nodes : TM_MAX_EBF;
+  if (ebf < TM_MIN_EBF) ebf = TM_MIN_EBF;
+  if (ebf > TM_MAX_EBF) ebf = TM_MAX_EBF;
+
+  return et <= allot && et + iter_time * ebf <= goal * TM_MAX_FINISH;
+}
+
+// Searches p to depth d with an aspiration window around last_score.
+static score_t aspiration_search(position_t *p, int d, score_t last_score,
+                                 move_t *subpv, search_context_t *ctx,
+                                 FILE *out) {
+  score_t alpha = -INF;
+  score_t beta = INF;
+  int delta = ASP_WINDOW;
+  if (d >= ASP_DEPTH && abs(last_score) < WIN - MAX_PLY_IN_SEARCH) {
+    alpha = last_score - delta > -INF ? last_score - delta : -INF;
+    beta = last_score + delta < INF ? last_score + delta : INF;
+  }
+
+  while (true) {
+    score_t score = searchRoot(p, alpha, beta, d, 0, subpv, ctx, out);
+    if (should_abort(ctx)) {
+      return score;
+    }
+    if (score <= alpha && alpha > -INF) {
+      alpha = alpha - delta > -INF ? alpha - delta : -INF;
+    } else if (score >= beta && beta < INF) {
+      beta = beta + delta < INF ? beta + delta : INF;
+    } else {
+      return score;
+    }
+    delta *= 2;
+  }
+}
+
+// Reports the num_lines best lines of the iteration at depth d, which took et
+// milliseconds, for multi-PV mode.
+static void print_lines(int d, double et, int num_lines,
+                        move_t pvs[][MAX_PLY_IN_SEARCH], score_t *scores) {
+  uint64_t nps = 1000 * search_ctx.nodes / (et > 1 ? et : 1);
+  for (int line = 0; line < num_lines; line++) {
+    char pvbuf[MAX_PLY_IN_SEARCH * MAX_CHARS_IN_MOVE];
+    getPV(pvs[line], pvbuf, MAX_PLY_IN_SEARCH * MAX_CHARS_IN_MOVE);
+    fprintf(OUT, "info depth %d multipv %d score cp %d time %d nodes %" PRIu64
+            " nps %" PRIu64 " pv %s\n", d, line + 1, scores[line], (int) et,
+            search_ctx.nodes, nps, pvbuf);
+  }
+}
+
 void *entry_point(void *arg) {
   move_t subpv[MAX_PLY_IN_SEARCH];
+  // in multi-PV mode, the lines other than the first one, and the scores
+  move_t line_pvs[MAX_NUM_MOVES][MAX_PLY_IN_SEARCH];
+  score_t line_scores[MAX_NUM_MOVES];
 
   entry_point_args *real_arg = (entry_point_args *) arg;
   int depth = real_arg->depth;
   position_t *p = real_arg->p;
-  double tme = real_arg->tme;
 
   double et = 0.0;
+  uint64_t last_nodes = 0;    // nodes of the previous iteration
+  score_t last_score = 0;     // and its score
+  int stable_iterations = 0;  // iterations since the best move changed
+
+  // In deterministic mode, the same commands make the search do the same
+  // work, so that two builds can be compared at equal work: the evaluation
+  // has no noise, the search runs serially, the root moves are shuffled
+  // from the same seed every time, and tablebase files that happen to be on
+  // disk do not count.  The transposition table and the killers carry over
+  // from the commands before, as always.
+  int randomize = RANDOMIZE;
+  int use_ybw = USE_YBW;
+  int use_tb = USE_TB;
+  if (DETERMINISTIC) {
+    RANDOMIZE = 0;
+    USE_YBW = 0;
+    USE_TB = 0;
+    init_rand_state(&search_ctx.rand);
+  }
 
-  // start time of search
-  init_abort_timer(tme);
-
-  init_best_move_history();
+  init_best_move_history(&search_ctx);
   tt_age_hashtable();
 
   init_tics();
+  init_root_moves(&search_ctx, p);
+  if (real_arg->num_searchmoves > 0) {
+    restrict_root_moves(&search_ctx, real_arg->searchmoves,
+                        real_arg->num_searchmoves);
+  }
+  int num_lines = real_arg->multipv;
+  if (num_lines > search_ctx.root.num_of_moves) {
+    num_lines = search_ctx.root.num_of_moves;
+  }
+  if (num_lines < 1) {
+    num_lines = 1;
+  }
+  search_ctx.root.num_lines = num_lines;
+  subpv[0] = 0;
+  memset(line_scores, 0, sizeof(line_scores));
 
   for (int d = 1; d <= depth; d++) {  // Iterative deepening
-    reset_abort();
-
-    searchRoot(p, -INF, INF, d, 0, subpv, &node_count_serial,
-                OUT);
+    reset_abort(&search_ctx);
+
+    uint64_t start_nodes = search_ctx.nodes;
+    double start = milliseconds();
+    search_ctx.root.line = 0;
+    score_t score = aspiration_search(p, d, last_score, subpv, &search_ctx,
+                                      OUT);
+
+    // The other lines share the iteration, and the transposition table
+    // entries that the first line left behind.
+    if (num_lines > 1 && !should_abort(&search_ctx)) {
+      line_scores[0] = score;
+      memcpy(line_pvs[0], subpv, sizeof(subpv));
+      int line;
+      for (line = 1; line < num_lines; line++) {
+        search_ctx.root.line = line;
+        line_pvs[line][0] = 0;
+        score_t line_score = aspiration_search(p, d, line_scores[line],
+                                               line_pvs[line], &search_ctx,
+                                               OUT);
+        if (should_abort(&search_ctx)) {
+          break;
+        }
+        line_scores[line] = line_score;
+      }
+      if (line == num_lines) {
+        print_lines(d, elapsed_time(&search_ctx), num_lines, line_pvs,
+                    line_scores);
+      }
+    }
+    double iter_time = milliseconds() - start;
+    uint64_t nodes = search_ctx.nodes - start_nodes;
 
-    et = elapsed_time();
+    et = elapsed_time(&search_ctx);
+    if (d > 1 && subpv[0] == bestMoveSoFar) {
+      stable_iterations++;
+    } else {
+      stable_iterations = 0;
+    }
     bestMoveSoFar = subpv[0];
+    ponderMoveSoFar = subpv[0] != 0 ? subpv[1] : 0;
 
-    if (!should_abort()) {
+    if (!should_abort(&search_ctx)) {
       // print something?
     } else {
       break;
     }
 
-    // don't start iteration that you cannot complete
-    if (et > tme * RATIO_FOR_TIMEOUT) break;
+    bool score_dropped = d > 1 && score < last_score - TM_SCORE_DROP;
+    if (!pondering &&
+        !time_for_next_iteration(real_arg->tme, et, iter_time, nodes,
+                                 last_nodes, stable_iterations,
+                                 score_dropped)) {
+      break;
+    }
+    last_nodes = nodes;
+    last_score = score;
   }
 
-  // This unlock will allow the main thread lock/unlock in UCIBeginSearch to
-  // proceed
-  pthread_mutex_unlock(&entry_mutex);
+  // Even a finished search must not answer while pondering
+  while (pondering && !should_abort(&search_ctx)) {
+    usleep(1000);
+  }
 
-  return NULL;
-}
+  RANDOMIZE = randomize;
+  USE_YBW = use_ybw;
+  USE_TB = use_tb;
 
-// Makes call to entry_point -> make call to searchRoot -> searchRoot in search.c
-void UciBeginSearch(position_t *p, int depth, double tme) {
-  pthread_mutex_lock(&entry_mutex);  // setup for the barrier
+  // the work of the whole search, to compare searches by
+  fprintf(OUT, "info nodes %" PRIu64 " time %d\n", search_ctx.nodes,
+          (int) elapsed_time(&search_ctx));
 
-  entry_point_args args;
-  args.depth = depth;
-  args.p = p;
-  args.tme = tme;
-  node_count_serial = 0;
-  entry_point(&args);
+#if STATS
+  fprintf(OUT, "info string stats ");
+  stats_print_json(OUT);
+#endif
 
   char bms[MAX_CHARS_IN_MOVE];
   move_to_str(bestMoveSoFar, bms, MAX_CHARS_IN_MOVE);
   snprintf(theMove, MAX_CHARS_IN_MOVE, "%s", bms);
-  fprintf(OUT, "bestmove %s\n", bms);
-  return;
+  if (ponderMoveSoFar != 0) {
+    char pms[MAX_CHARS_IN_MOVE];
+    move_to_str(ponderMoveSoFar, pms, MAX_CHARS_IN_MOVE);
+    fprintf(OUT, "bestmove %s ponder %s\n", bms, pms);
+  } else {
+    fprintf(OUT, "bestmove %s\n", bms);
+  }
+
+  return NULL;
+}
+
+// Starts entry_point -> searchRoot in search.c on the search thread, which
+// prints bestmove when it is done.  p must not change until then.  With
+// ponder, the goal time tme only applies from ponderhit on.  The search stops
+// after nodes nodes, unless that is 0.  It reports the best multipv lines, and
+// only searches the num_searchmoves moves of searchmoves, unless there are
+// none.
+void UciBeginSearch(position_t *p, int depth, uint64_t nodes, double tme,
+                    bool ponder, int multipv, const move_t *searchmoves,
+                    int num_searchmoves) {
+  search_args.depth = depth;
+  search_args.p = p;
+  search_args.tme = tme;
+  search_args.multipv = multipv;
+  search_args.num_searchmoves = num_searchmoves;
+  for (int i = 0; i < num_searchmoves; i++) {
+    search_args.searchmoves[i] = searchmoves[i];
+  }
+  pondering = ponder;
+  search_ctx.nodes = 0;
+  init_node_limit(&search_ctx, nodes);
+#if STATS
+  stats_reset();
+#endif
+
+  // start time of search
+  init_stop(&search_ctx);
+  init_abort_timer(&search_ctx, ponder ? INF_TIME : tme);
+
+  if (pthread_create(&search_thread, NULL, &entry_point, &search_args) != 0) {
+    fprintf(stderr, "Could not start the search thread.\n");
+    exit(1);
+  }
+  search_running = true;
+}
+
+// Waits for the search thread, if any, to print bestmove and finish.
+void UciWaitForSearch() {
+  if (search_running) {
+    pthread_join(search_thread, NULL);
+    search_running = false;
+  }
+}
+
+// The opponent played the move we were pondering on: now it is our time.
+void UciPonderHit() {
+  if (search_running && pondering) {
+    init_abort_timer(&search_ctx, search_args.tme);
+    pondering = false;
+  }
+}
+
+// Stops the search, if any, and waits for it to answer.
+void UciStopSearch() {
+  if (search_running) {
+    stop_search(&search_ctx);
+    pondering = false;
+    UciWaitForSearch();
+  }
+}
+
+// -----------------------------------------------------------------------------
+// Benchmark
+// -----------------------------------------------------------------------------
+
+#define BENCH_DEPTH 6
+
+// Positions searched by bench, as fen strings ("" is the opening position)
+static char *bench_positions[] = {
+  "",
+#if BOARD_WIDTH == 8
+  "ss3nw3/3nw4/2nw1nw3/1nw3SE1SE/nw1nw3SE1/3SE1SE2/4SE3/3SE3NN B",
+  "ss7/3nw1nw2/1nenw1nw1SW1/8/4SE1SW1/3SE1SE2/ne7/3NE1NW1NN W",
+  "7SW/6nw1/eeswse3SW1/8/4NE3/3SW1SE2/1ne6/3NE1NW1NN B",
+  "7SW/5SE2/eesw1se4/5NW2/4nw3/2neSW2SW1/8/3NE1NW1NN W",
+  "ss3se3/2se3SW1/4se3/1ne1nw1SE2/2nw3SW1/1nwSESE1SE2/2SE4NN/8 W",
+  "ss3se3/2se3SW1/8/1ne1nwNWse2/3SE1SESW1/1ne1sw4/1NESW4NN/8 B",
+  "5se2/6SW1/2sssw4/ne1NWSW1se2/6sw1/3se3SW/1NENE1SW2NN/8 B",
+  "8/1ss6/2ne4SE/1ne3SW2/2NW5/3NN4/3SEse1SE1/8 W",
+#endif
+  NULL
+};
+
+// Searches each of bench_positions to the given depth and reports the nodes
+// and time per position, and in total.  The search runs serially from a
+// cleared state with no randomization and no tablebases, so the node counts
+// only change when the search does.  The signature folds them together with
+// the best moves.
+void bench(int depth) {
+  int randomize = RANDOMIZE;
+  int use_ybw = USE_YBW;
+  int use_tb = USE_TB;
+  FILE *out = OUT;
+  RANDOMIZE = 0;
+  USE_YBW = 0;
+  USE_TB = 0;
+  // The search prints its progress here, or to out if it cannot be opened.
+  FILE *devnull = fopen("/dev/null", "w");
+  if (devnull != NULL) {
+    OUT = devnull;
+  } else {
+    fprintf(out, "info string cannot open /dev/null for the search output\n");
+  }
+
+  position_t p;
+  uint64_t total_nodes = 0;
+  uint64_t signature = 14695981039346656037ULL;  // FNV-1a
+  double total_time = 0;
+
+  for (int i = 0; bench_positions[i] != NULL; i++) {
+    fen_to_pos(&p, bench_positions[i]);
+    tt_clear_hashtable();
+    init_killers(&search_ctx);
+    init_rand_state(&search_ctx.rand);
+
+    double start = milliseconds();
+    UciBeginSearch(&p, depth, 0, INF_TIME, false, 1, NULL, 0);
+    UciWaitForSearch();
+    double et = milliseconds() - start;
+
+    total_nodes += search_ctx.nodes;
+    total_time += et;
+    signature = (signature ^ search_ctx.nodes) * 1099511628211ULL;
+    signature = (signature ^ bestMoveSoFar) * 1099511628211ULL;
+
+    if (et < 1) {
+      et = 1;  // do not divide by 0
+    }
+    fprintf(out, "info bench position %d depth %d nodes %" PRIu64
+            " time (ms) %d nps %" PRIu64 " bestmove %s\n", i + 1, depth,
+            search_ctx.nodes, (int) et,
+            (uint64_t) (1000 * search_ctx.nodes / et), theMove);
+  }
+
+  if (devnull != NULL) {
+    fclose(devnull);
+  }
+  OUT = out;
+  RANDOMIZE = randomize;
+  USE_YBW = use_ybw;
+  USE_TB = use_tb;
+  tt_clear_hashtable();
+
+  if (total_time < 1) {
+    total_time = 1;
+  }
+  fprintf(OUT, "bench nodes %" PRIu64 " time (ms) %d nps %" PRIu64
+          " signature %016" PRIx64 "\n", total_nodes, (int) total_time,
+          (uint64_t) (1000 * total_nodes / total_time), signature);
+}
+
+// -----------------------------------------------------------------------------
+// Batch analysis
+// -----------------------------------------------------------------------------
+
+// Longest line of an EPD file that batch reads
+#define BATCH_LINE_CHARS 1024
+#define BATCH_MAX_THREADS 64
+
+typedef struct {
+  int        line;                  // line of the EPD file
+  bool       valid;                 // whether the fen parsed
+  position_t pos;
+  char       id[MAX_CHARS_IN_TOKEN];  // the id operation of the EPD, or ""
+  // the result, once done
+  bool       done;
+  move_t     best_move;
+  score_t    score;
+  int        depth;                 // of the last iteration that finished
+  uint64_t   nodes;
+  double     time;                  // in milliseconds
+} batchPosition;
+
+typedef struct {
+  batchPosition  *positions;
+  int             num_positions;
+  int             depth;        // search to this depth,
+  uint64_t        nodes;        // or this many nodes, unless 0
+  int             next;         // the next position to search
+  int             next_report;  // the next position to write out
+  pthread_mutex_t report_mutex;
+  FILE           *out;
+} batchJob;
+
+// Reads the positions of an EPD file: a board and the side to move, followed
+// by operations, of which only id is kept.  Empty lines and lines starting
+// with '#' are skipped.  Returns the number of positions, or -1 on error.
+static int read_epd(const char *filename, batchPosition **positions) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    return -1;
+  }
+
+  int n = 0;
+  int size = 0;
+  batchPosition *list = NULL;
+  char buf[BATCH_LINE_CHARS];
+  for (int line = 1; fgets(buf, sizeof(buf), f) != NULL; line++) {
+    char board[BATCH_LINE_CHARS];
+    char side[BATCH_LINE_CHARS];
+    int num_fields = sscanf(buf, "%s %s", board, side);
+    if (num_fields < 1 || board[0] == '#') {
+      continue;
+    }
+    if (n == size) {
+      size = (size == 0) ? 256 : 2 * size;
+      list = (batchPosition *) realloc(list, sizeof(batchPosition) * size);
+      if (list == NULL) {
+        fclose(f);
+        return -1;
+      }
+    }
+
+    batchPosition *bp = &list[n++];
+    memset(bp, 0, sizeof(batchPosition));
+    bp->line = line;
+    char fen[2 * BATCH_LINE_CHARS + 2];
+    snprintf(fen, sizeof(fen), "%s %s", board, num_fields > 1 ? side : "");
+    bp->valid = fen_to_pos(&bp->pos, fen) == 0;
+
+    char *id = strstr(buf, " id \"");
+    if (id != NULL) {
+      id += strlen(" id \"");
+      int len = strcspn(id, "\"");
+      snprintf(bp->id, sizeof(bp->id), "%.*s", len, id);
+    }
+  }
+
+  fclose(f);
+  *positions = list;
+  return n;
+}
+
+// Searches bp by iterative deepening with ctx, and keeps the result of the
+// last iteration that finished.
+static void batch_search(batchJob *job, batchPosition *bp,
+                         search_context_t *ctx) {
+  double start = milliseconds();
+  init_stop(ctx);
+  init_abort_timer(ctx, INF_TIME);
+  init_node_limit(ctx, job->nodes);
+  ctx->nodes = 0;
+  init_killers(ctx);
+  init_best_move_history(ctx);
+  init_tics();
+  init_rand_state(&ctx->rand);  // the same order whichever worker searches bp
+  init_root_moves(ctx, &bp->pos);
+
+  move_t pv[MAX_PLY_IN_SEARCH];
+  pv[0] = 0;
+  bp->best_move = 0;
+  bp->score = 0;
+  bp->depth = 0;
+  for (int d = 1; d <= job->depth; d++) {
+    reset_abort(ctx);
+    score_t score = aspiration_search(&bp->pos, d, bp->score, pv, ctx, NULL);
+    if (should_abort(ctx)) {
+      break;
+    }
+    bp->best_move = pv[0];
+    bp->score = score;
+    bp->depth = d;
+  }
+  if (bp->depth == 0) {
+    bp->best_move = pv[0];  // whatever the first iteration got to
+  }
+  bp->nodes = ctx->nodes;
+  bp->time = milliseconds() - start;
+}
+
+// Writes out the results of the positions that are done, in the order of the
+// file.  The caller holds job->report_mutex.
+static void batch_report(batchJob *job) {
+  for (; job->next_report < job->num_positions &&
+           job->positions[job->next_report].done; job->next_report++) {
+    batchPosition *bp = &job->positions[job->next_report];
+    if (!bp->valid) {
+      fprintf(job->out, "info batch position %d line %d invalid\n",
+              job->next_report + 1, bp->line);
+      continue;
+    }
+    char bms[MAX_CHARS_IN_MOVE];
+    move_to_str(bp->best_move, bms, MAX_CHARS_IN_MOVE);
+    fprintf(job->out, "info batch position %d line %d depth %d score cp %d "
+            "nodes %" PRIu64 " time (ms) %d bestmove %s%s%s%s\n",
+            job->next_report + 1, bp->line, bp->depth, bp->score, bp->nodes,
+            (int) bp->time, bms, bp->id[0] ? " id \"" : "", bp->id,
+            bp->id[0] ? "\"" : "");
+  }
+  fflush(job->out);
+}
+
+// A worker of batch: takes the next position until there are none left.  It
+// searches with a search context of its own, and shares only the
+// transposition table with the others.
+static void *batch_worker(void *arg) {
+  batchJob *job = (batchJob *) arg;
+  search_context_t *ctx;
+  if (posix_memalign((void **) &ctx, 64, sizeof(search_context_t)) != 0) {
+    // Leave the positions to the other workers; batch reports any that are
+    // left over.
+    pthread_mutex_lock(&job->report_mutex);
+    fprintf(OUT, "info string batch worker cannot allocate a search context\n");
+    pthread_mutex_unlock(&job->report_mutex);
+    return NULL;
+  }
+
+  while (true) {
+    int i = __sync_fetch_and_add(&job->next, 1);
+    if (i >= job->num_positions) {
+      break;
+    }
+    batchPosition *bp = &job->positions[i];
+    if (bp->valid) {
+      batch_search(job, bp, ctx);
+    }
+
+    pthread_mutex_lock(&job->report_mutex);
+    bp->done = true;
+    batch_report(job);
+    pthread_mutex_unlock(&job->report_mutex);
+  }
+
+  free(ctx);
+  return NULL;
+}
+
+// Searches each position of an EPD file to the given depth, or until it has
+// searched the given number of nodes if that is not 0, and writes the best
+// move, score, nodes and time of each to out, one line per position and in the
+// order of the file.  With more than one thread, the positions are searched
+// in parallel, and the results depend on the timing of the threads.
+void batch(const char *filename, int depth, uint64_t nodes, int threads,
+           FILE *out) {
+  batchJob job;
+  job.num_positions = read_epd(filename, &job.positions);
+  if (job.num_positions < 0) {
+    fprintf(OUT, "info string cannot read %s\n", filename);
+    return;
+  }
+  job.depth = depth;
+  job.nodes = nodes;
+  job.next = 0;
+  job.next_report = 0;
+  job.out = out;
+  pthread_mutex_init(&job.report_mutex, NULL);
+
+  if (threads < 1) {
+    threads = 1;
+  } else if (threads > BATCH_MAX_THREADS) {
+    threads = BATCH_MAX_THREADS;
+  }
+
+  tt_age_hashtable();
+  double start = milliseconds();
+  pthread_t workers[BATCH_MAX_THREADS];
+  int num_workers = 0;
+  for (; num_workers < threads; num_workers++) {
+    if (pthread_create(&workers[num_workers], NULL, &batch_worker,
+                       &job) != 0) {
+      break;
+    }
+  }
+  if (num_workers == 0) {
+    batch_worker(&job);
+  }
+  for (int i = 0; i < num_workers; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  double et = milliseconds() - start;
+  if (job.next_report < job.num_positions) {
+    fprintf(OUT, "info string batch searched %d of %d positions\n",
+            job.next_report, job.num_positions);
+  }
+
+  uint64_t total_nodes = 0;
+  for (int i = 0; i < job.num_positions; i++) {
+    total_nodes += job.positions[i].nodes;
+  }
+  if (et < 1) {
+    et = 1;  // do not divide by 0
+  }
+  fprintf(OUT, "batch positions %d nodes %" PRIu64 " time (ms) %d nps %"
+          PRIu64 "\n", job.num_positions, total_nodes, (int) et,
+          (uint64_t) (1000 * total_nodes / et));
+
+  pthread_mutex_destroy(&job.report_mutex);
+  free(job.positions);
 }
 
 // -----------------------------------------------------------------------------
@@ -245,17 +849,49 @@ void UciBeginSearch(position_t *p, int depth, double tme) {
 
 // print help messages in uci
 void help()  {
+  printf("batch     - Search each position of an EPD file and write one line per position\n");
+  printf("            with its best move, score, depth, nodes and time.  After the file\n");
+  printf("            name, possible arguments are:\n");
+  printf("            depth <depth>:     search to depth <depth> (default %d)\n", BENCH_DEPTH);
+  printf("            nodes <nodes>:     search until <nodes> nodes, and to no fixed\n");
+  printf("                               depth unless one is given\n");
+  printf("            threads <threads>: search this many positions in parallel\n");
+  printf("            out <file>:        write the results to <file>\n");
+  printf("            Sample usage: \n");
+  printf("                batch games.epd nodes 100000 threads 4 out games.out\n");
+  printf("bench     - Search a fixed set of positions and report the node counts and speed.\n");
+  printf("            Takes an optional depth argument (default %d).\n", BENCH_DEPTH);
+  printf("book      - Open the opening book in the given file, or report on the open one.\n");
+  printf("            " BOOK_FILE " is opened at startup if it exists.  With the\n");
+  printf("            ownbook option set, go answers with a book move right away,\n");
+  printf("            unless it is given a depth or ponder.\n");
+  printf("            Sample usage: \n");
+  printf("                book openings.book: play from openings.book\n");
   printf("eval      - Evaluate current position.\n");
   printf("display   - Display current board state.\n");
+  printf("divide    - Output the number of move paths of a given depth below each\n");
+  printf("            move of the current position.  Takes the same arguments as perft.\n");
+  printf("            Sample usage: \n");
+  printf("                divide 5: count the paths of length 5 through each move\n");
   printf("generate  - Generate all possible moves.\n");
   printf("go        - Search from current state.  Possible arguments are:\n");
   printf("            depth <depth>:     search until depth <depth>\n");
+  printf("            nodes <nodes>:     search until <nodes> nodes; with the deterministic\n");
+  printf("                               option set, the same commands always give the\n");
+  printf("                               same search\n");
   printf("            time <time_limit>: search assume you have <time> amount of time\n");
   printf("                               for the whole game.\n");
   printf("            inc <time_inc>:    set the fischer time increment for the search\n");
+  printf("            ponder:            search on the opponent's time until ponderhit\n");
+  printf("            multipv <n>:       report the best <n> moves with their lines\n");
+  printf("                               after each iteration\n");
+  printf("            searchmoves <move> ...: only search these moves\n");
   printf("            Both time arguments are specified in milliseconds.\n");
+  printf("            The search runs in the background; commands other than stop,\n");
+  printf("            ponderhit and isready wait for it to finish.\n");
   printf("            Sample usage: \n");
   printf("                go depth 4: search until depth 4\n");
+  printf("                go depth 6 multipv 3: the best 3 moves at depth 6\n");
   printf("help      - Display help (this info).\n");
   printf("isready   - Ask if the UCI engine is ready, if so it echoes \"readyok\".\n");
   printf("            This is mainly used to synchronize the engine with the GUI.\n");
@@ -263,9 +899,12 @@ void help()  {
   printf("            Sample usage: \n");
   printf("                move j0j1: move a piece from j0 to j1\n");
   printf("perft     - Output the number of possible moves upto a given depth.\n");
-  printf("            Used to verify move the generator.\n");
+  printf("            Used to verify move the generator.  An optional second argument\n");
+  printf("            caches subtree counts in a hash table of that many MBytes.\n");
   printf("            Sample usage: \n");
   printf("                depth 3: generate all possible moves for depth 1--3\n");
+  printf("                perft 6 256: the same up to depth 6, with a 256 MByte cache\n");
+  printf("ponderhit - The opponent played the move pondered on: keep searching on our time.\n");
   printf("position  - Set up the board using the fenstring given.  Possible arguments are:\n");
   printf("            startpos:     set up the board with default starting position.\n");
   printf("            endgame:      set up the board with endgame configuration.\n");
@@ -279,6 +918,16 @@ void help()  {
   printf("            Use the comment \"uci\" to see possible options and their current values\n");
   printf("            Sample usage: \n");
   printf("                setoption name fut_depth value 4: set fut_depth to 4\n");
+  printf("stats     - Print the statistics of the last search as JSON: node counts,\n");
+  printf("            cut-off and re-search rates, and time in eval, move generation\n");
+  printf("            and make move.  Needs a build with STATS=1 (make STATS=1), which\n");
+  printf("            also prints them after each go.\n");
+  printf("stop      - Stop searching and output the best move so far.\n");
+  printf("tablebase - Open the endgame tablebases in the given directory, or report on\n");
+  printf("            the open ones.  Those in the working directory are opened at\n");
+  printf("            startup.  The search probes them with the use_tb option set.\n");
+  printf("            Sample usage: \n");
+  printf("                tablebase /tmp/tb: use the tables that gen_tablebase wrote to /tmp/tb\n");
   printf("uci       - Display UCI version and options\n");
   printf("\n");
 }
@@ -411,6 +1060,10 @@ int main(int argc, char *argv[]) {
 
   init_options();
   init_zob();
+  init_rand_state(&search_ctx.rand);
+  init_laser_tables();
+  init_eval_tables();
+  init_lmr_table();
 
   char **tok = (char **) malloc(sizeof(char *) * MAX_CHARS_IN_TOKEN * MAX_PLY_IN_GAME);
   int   ix = 0;  // index of which position we are operating on
@@ -423,6 +1076,11 @@ int main(int argc, char *argv[]) {
   tt_make_hashtable(HASH);   // initial hash table
   fen_to_pos(&gme[ix], "");  // initialize with an actual position
 
+  if (access(BOOK_FILE, F_OK) == 0 && book_open(BOOK_FILE) < 0) {
+    fprintf(OUT, "info string cannot use the opening book %s\n", BOOK_FILE);
+  }
+  int num_tables = tb_open(".");
+
   //  Check to make sure we don't loop infinitely if we don't get input.
   bool saw_input = false;
   double start_time = milliseconds();
@@ -443,6 +1101,29 @@ int main(int argc, char *argv[]) {
         saw_input = true;
       }
 
+      // These are answered right away, even while the engine is thinking
+      if (strcmp(tok[0], "stop") == 0) {
+        UciStopSearch();
+        continue;
+      }
+
+      if (strcmp(tok[0], "ponderhit") == 0) {
+        UciPonderHit();
+        continue;
+      }
+
+      if (strcmp(tok[0], "isready") == 0) {
+        printf("readyok\n");
+        continue;
+      }
+
+      // Any other command waits for the search to finish.  A pondering search
+      // would never finish on its own, so it is stopped.
+      if (pondering) {
+        UciStopSearch();
+      }
+      UciWaitForSearch();
+
       if (strcmp(tok[0], "quit") == 0) {
         break;
       }
@@ -528,11 +1209,6 @@ int main(int argc, char *argv[]) {
         continue;
       }
 
-      if (strcmp(tok[0], "isready") == 0) {
-        printf("readyok\n");
-        continue;
-      }
-
       if (strcmp(tok[0], "setoption") == 0) {
         int sostate = 0;
         char  name[MAX_CHARS_IN_TOKEN];
@@ -601,6 +1277,12 @@ int main(int argc, char *argv[]) {
                 printf("info string Total hash table size: %zu bytes\n",
                        tt_get_num_of_records() * tt_get_bytes_per_record());
               }
+              if (strcmp(name+1, "pcentral") == 0) {
+                init_eval_tables();
+              }
+              if (strncmp(name+1, "lmr_", 4) == 0) {
+                init_lmr_table();
+              }
               break;
             }
           }
@@ -654,7 +1336,12 @@ int main(int argc, char *argv[]) {
         double tme = 0.0;
         double inc = 0.0;
         int    depth = INF_DEPTH;
+        uint64_t nodes = 0;
         double goal = INF_TIME;
+        bool   ponder = false;
+        int    multipv = 1;
+        int    num_searchmoves = 0;
+        move_t searchmoves[MAX_NUM_MOVES];
 
         // process various tokens here
         for (int n = 1; n < token_count; n++) {
@@ -663,6 +1350,11 @@ int main(int argc, char *argv[]) {
             depth = strtol(tok[n], (char **)NULL, 10);
             continue;
           }
+          if (strcmp(tok[n], "nodes") == 0) {
+            n++;
+            nodes = strtoull(tok[n], (char **)NULL, 10);
+            continue;
+          }
           if (strcmp(tok[n], "time") == 0) {
             n++;
             tme = strtod(tok[n], (char **)NULL);
@@ -673,33 +1365,154 @@ int main(int argc, char *argv[]) {
             inc = strtod(tok[n], (char **)NULL);
             continue;
           }
+          if (strcmp(tok[n], "ponder") == 0) {
+            ponder = true;
+            continue;
+          }
+          if (strcmp(tok[n], "multipv") == 0) {
+            n++;
+            multipv = strtol(tok[n], (char **)NULL, 10);
+            continue;
+          }
+          if (strcmp(tok[n], "searchmoves") == 0) {
+            // the moves run up to the first token that is not one
+            while (n + 1 < token_count && num_searchmoves < MAX_NUM_MOVES) {
+              move_t mv = move_from_string(&gme[ix], tok[n + 1]);
+              if (mv == 0) {
+                break;
+              }
+              searchmoves[num_searchmoves++] = mv;
+              n++;
+            }
+            continue;
+          }
         }
 
-        if (depth < INF_DEPTH) {
-          UciBeginSearch(&gme[ix], depth, INF_TIME);
+        // A book move takes no time at all
+        if (OWN_BOOK && depth == INF_DEPTH && nodes == 0 && !ponder &&
+            multipv == 1 && num_searchmoves == 0) {
+          move_t mv = book_probe(&gme[ix]);
+          if (mv != 0) {
+            char bms[MAX_CHARS_IN_MOVE];
+            move_to_str(mv, bms, MAX_CHARS_IN_MOVE);
+            fprintf(OUT, "info string book move\n");
+            fprintf(OUT, "bestmove %s\n", bms);
+            continue;
+          }
+        }
+
+        // A depth or a node budget without a clock limits the search alone
+        if (depth < INF_DEPTH || (nodes > 0 && tme == 0.0 && inc == 0.0)) {
+          UciBeginSearch(&gme[ix], depth, nodes, INF_TIME, ponder, multipv,
+                         searchmoves, num_searchmoves);
         } else {
           goal = tme * 0.02;   // use about 1/50 of main time
           goal += inc * 0.80;  // use most of increment
           // sanity check,  make sure that we don't run ourselves too low
           if (goal*10 > tme) goal = tme / 10.0;
-          UciBeginSearch(&gme[ix], INF_DEPTH, goal);
+          UciBeginSearch(&gme[ix], INF_DEPTH, nodes, goal, ponder, multipv,
+                         searchmoves, num_searchmoves);
+        }
+        continue;
+      }
+
+      if (strcmp(tok[0], "book") == 0) {
+        if (token_count >= 2 && book_open(tok[1]) < 0) {
+          fprintf(OUT, "info string cannot use the opening book %s\n", tok[1]);
+          continue;
+        }
+        fprintf(OUT, "info string book entries %" PRId64 "\n",
+                book_num_entries());
+        continue;
+      }
+
+      if (strcmp(tok[0], "stats") == 0) {
+#if STATS
+        fprintf(OUT, "info string stats ");
+        stats_print_json(OUT);
+#else
+        fprintf(OUT, "info string stats need a build with STATS=1\n");
+#endif
+        continue;
+      }
+
+      if (strcmp(tok[0], "tablebase") == 0) {
+        if (token_count >= 2) {
+          num_tables = tb_open(tok[1]);
+        }
+        fprintf(OUT, "info string tablebases %d\n", num_tables);
+        continue;
+      }
+
+      if (strcmp(tok[0], "bench") == 0) {
+        int depth = BENCH_DEPTH;
+        if (token_count >= 2) {
+          depth = strtol(tok[1], (char **)NULL, 10);
+        }
+        bench(depth);
+        continue;
+      }
+
+      if (strcmp(tok[0], "batch") == 0) {
+        if (token_count < 2) {
+          fprintf(OUT, "Second argument (the EPD file) required.\n");
+          continue;
+        }
+        int      depth = 0;
+        uint64_t nodes = 0;
+        int      threads = 1;
+        FILE    *out = OUT;
+        for (int n = 2; n + 1 < token_count; n += 2) {
+          if (strcmp(tok[n], "depth") == 0) {
+            depth = strtol(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "nodes") == 0) {
+            nodes = strtoull(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "threads") == 0) {
+            threads = strtol(tok[n + 1], (char **)NULL, 10);
+          } else if (strcmp(tok[n], "out") == 0 && out == OUT) {
+            out = fopen(tok[n + 1], "w");
+            if (out == NULL) {
+              fprintf(OUT, "info string cannot write %s\n", tok[n + 1]);
+              break;
+            }
+          }
+        }
+        if (out == NULL) {
+          continue;
+        }
+        if (depth <= 0) {
+          depth = (nodes > 0) ? INF_DEPTH : BENCH_DEPTH;
+        }
+        batch(tok[1], depth, nodes, threads, out);
+        if (out != OUT) {
+          fclose(out);
         }
         continue;
       }
 
-      if (strcmp(tok[0], "perft") == 0) {  // Test move generator
+      if (strcmp(tok[0], "perft") == 0 ||
+          strcmp(tok[0], "divide") == 0) {  // Test move generator
         // Correct output to depth 4
         // perft  1 78
         // perft  2 6084
         // perft  3 473126
         // perft  4 36767050
 
-
+        bool divide = strcmp(tok[0], "divide") == 0;
         int depth = 4;
         if (token_count >= 2) {  // Takes a depth argument to test deeper
           depth = strtol(tok[1], (char **)NULL, 10);
         }
-        do_perft(gme, depth, 0);
+        int hash_mb = 0;
+        if (token_count >= 3) {  // and the size of a cache of subtree counts
+          hash_mb = strtol(tok[2], (char **)NULL, 10);
+        }
+        if (divide) {
+          do_perft(&gme[ix], depth, hash_mb, true);
+        } else {
+          fen_to_pos(gme, "");
+          do_perft(gme, depth, hash_mb, false);
+        }
         continue;
       }
 
@@ -707,6 +1520,7 @@ int main(int argc, char *argv[]) {
       continue;
     }
   }
+  UciStopSearch();
   tt_free_hashtable();
 
   return 0;
@@ -5,10 +5,13 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 
+#include <cilk/cilk.h>
+
 #include "./eval.h"
 #include "./fen.h"
 #include "./search.h"
@@ -26,57 +29,6 @@ char *color_to_str(color_t c) {
   return color_strs[c];
 }
 
-// -----------------------------------------------------------------------------
-// Piece getters and setters (including color, ptype, orientation)
-// -----------------------------------------------------------------------------
-
-// which color is moving next
-color_t color_to_move_of(position_t *p) {
-  if ((p->ply & 1) == 0) {
-    return WHITE;
-  } else {
-    return BLACK;
-  }
-}
-
-color_t color_of(piece_t x) {
-  return (color_t) ((x >> COLOR_SHIFT) & COLOR_MASK);
-}
-
-color_t opp_color(color_t c) {
-  if (c == WHITE) {
-    return BLACK;
-  } else {
-    return WHITE;
-  }
-}
-
-
-void set_color(piece_t *x, color_t c) {
-  tbassert((c >= 0) & (c <= COLOR_MASK), "color: %d\n", c);
-  *x = ((c & COLOR_MASK) << COLOR_SHIFT) |
-      (*x & ~(COLOR_MASK << COLOR_SHIFT));
-}
-
-
-ptype_t ptype_of(piece_t x) {
-  return (ptype_t) ((x >> PTYPE_SHIFT) & PTYPE_MASK);
-}
-
-void set_ptype(piece_t *x, ptype_t pt) {
-  *x = ((pt & PTYPE_MASK) << PTYPE_SHIFT) |
-      (*x & ~(PTYPE_MASK << PTYPE_SHIFT));
-}
-
-int ori_of(piece_t x) {
-  return (x >> ORI_SHIFT) & ORI_MASK;
-}
-
-void set_ori(piece_t *x, int ori) {
-  *x = ((ori & ORI_MASK) << ORI_SHIFT) |
-      (*x & ~(ORI_MASK << ORI_SHIFT));
-}
-
 // -----------------------------------------------------------------------------
 // Piece orientation strings
 // -----------------------------------------------------------------------------
@@ -130,6 +82,69 @@ void init_zob() {
   zob_color = myrand();
 }
 
+// -----------------------------------------------------------------------------
+// Bitboards
+// -----------------------------------------------------------------------------
+
+// Adds piece x to the bitboards at square sq, or removes it if it is already
+// there.  Like the Zobrist key, the bitboards are updated with XOR, so every
+// key update in move execution has a matching bb_toggle.  EMPTY "pieces" are
+// tracked in bb_ptype[EMPTY] only.
+static inline void bb_toggle(position_t *p, square_t sq, piece_t x) {
+  bitboard_t b = bb_of(sq);
+  ptype_t typ = ptype_of(x);
+  p->bb_ptype[typ] ^= b;
+  if (typ != EMPTY) {
+    p->bb_color[color_of(x)] ^= b;
+    p->bb_ori[ori_of(x)] ^= b;
+  }
+  if (typ == PAWN) {  // keep pawn_ev in step: add or remove the Pawn
+    int32_t ev = pawn_square_ev[bb_index(sq)];
+    p->pawn_ev[color_of(x)] += (p->bb_ptype[PAWN] & b) ? ev : -ev;
+  }
+}
+
+// Rebuilds the bitboards of p from its mailbox
+void init_bitboards(position_t *p) {
+  memset(p->bb_color, 0, sizeof(p->bb_color));
+  memset(p->bb_ptype, 0, sizeof(p->bb_ptype));
+  memset(p->bb_ori, 0, sizeof(p->bb_ori));
+  memset(p->pawn_ev, 0, sizeof(p->pawn_ev));
+  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+      square_t sq = square_of(f, r);
+      bb_toggle(p, sq, p->board[sq]);
+    }
+  }
+}
+
+// Debugging check that the bitboards of p agree with its mailbox
+bool check_bitboards(position_t *p) {
+  position_t q = *p;
+  init_bitboards(&q);
+  return memcmp(q.bb_color, p->bb_color, sizeof(p->bb_color)) == 0 &&
+      memcmp(q.bb_ptype, p->bb_ptype, sizeof(p->bb_ptype)) == 0 &&
+      memcmp(q.bb_ori, p->bb_ori, sizeof(p->bb_ori)) == 0 &&
+      memcmp(q.pawn_ev, p->pawn_ev, sizeof(p->pawn_ev)) == 0;
+}
+
+// Recomputes pawn_ev, e.g., after pawn_square_ev changed.
+void init_pawn_ev(position_t *p) {
+  memset(p->pawn_ev, 0, sizeof(p->pawn_ev));
+  for (bitboard_t pawns = p->bb_ptype[PAWN]; pawns; pawns &= pawns - 1) {
+    int i = bb_lsb(pawns);
+    p->pawn_ev[color_of(p->board[bb_square(i)])] += pawn_square_ev[i];
+  }
+}
+
+// Two positions have the same pieces on the same squares exactly when all of
+// their bitboards match.
+static bool same_board(position_t *a, position_t *b) {
+  return memcmp(a->bb_color, b->bb_color, sizeof(a->bb_color)) == 0 &&
+      memcmp(a->bb_ptype, b->bb_ptype, sizeof(a->bb_ptype)) == 0 &&
+      memcmp(a->bb_ori, b->bb_ori, sizeof(a->bb_ori)) == 0;
+}
+
 // -----------------------------------------------------------------------------
 // Squares
 // -----------------------------------------------------------------------------
@@ -205,33 +220,9 @@ int reflect_of(int beam_dir, int pawn_ori) {
 }
 
 // -----------------------------------------------------------------------------
-// Move getters and setters
+// Move notation
 // -----------------------------------------------------------------------------
 
-ptype_t ptype_mv_of(move_t mv) {
-  return (ptype_t) ((mv >> PTYPE_MV_SHIFT) & PTYPE_MV_MASK);
-}
-
-square_t from_square(move_t mv) {
-  return (mv >> FROM_SHIFT) & FROM_MASK;
-}
-
-square_t to_square(move_t mv) {
-  return (mv >> TO_SHIFT) & TO_MASK;
-}
-
-rot_t rot_of(move_t mv) {
-  return (rot_t) ((mv >> ROT_SHIFT) & ROT_MASK);
-}
-
-move_t move_of(ptype_t typ, rot_t rot, square_t from_sq, square_t to_sq) {
-  return ((typ & PTYPE_MV_MASK) << PTYPE_MV_SHIFT) |
-      ((rot & ROT_MASK) << ROT_SHIFT) |
-      ((from_sq & FROM_MASK) << FROM_SHIFT) |
-      ((to_sq & TO_MASK) << TO_SHIFT);
-}
-
-
 // converts a move to string notation for FEN
 void move_to_str(move_t mv, char *buf, size_t bufsize) {
   square_t f = from_square(mv);  // from-square
@@ -267,84 +258,79 @@ void move_to_str(move_t mv, char *buf, size_t bufsize) {
 // Move generation
 // -----------------------------------------------------------------------------
 
-// Generate all moves from position p.  Returns number of moves.
-// strict currently ignored
-//
-// https://chessprogramming.wikispaces.com/Move+Generation
-int generate_all(position_t *p, sortable_move_t *sortable_move_list,
-                 bool strict) {
+// Generate the moves from position p that start or end on a square of touch if
+// touching is true, or that touch none of them if touching is false.  Returns
+// number of moves.  Either way the moves come out in the order of
+// generate_all().
+static int generate_moves(position_t *p, sortable_move_t *sortable_move_list,
+                          bitboard_t touch, bool touching) {
   color_t color_to_move = color_to_move_of(p);
-  // Make sure that the enemy_laser map is marked
-  char laser_map[ARR_SIZE];
-
-  for (int i = 0; i < ARR_SIZE; ++i) {
-    laser_map[i] = 4;   // Invalid square
-  }
-
-  for (fil_t f = 0; f < BOARD_WIDTH; ++f) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; ++r) {
-      laser_map[square_of(f, r)] = 0;
-    }
-  }
-
-  // 1 = path of laser with no moves
-  mark_laser_path(p, opp_color(color_to_move), laser_map, 1);
+  // Pawns on the path of the enemy laser are pinned down
+  bitboard_t enemy_laser = laser_path(p, opp_color(color_to_move));
 
   int move_count = 0;
 
-  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
-    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
-      square_t  sq = square_of(f, r);
-      piece_t x = p->board[sq];
+  // Visit only our own pieces, in the same order as a scan of the board
+  for (bitboard_t own = p->bb_color[color_to_move]; own; own &= own - 1) {
+    square_t  sq = bb_square(bb_lsb(own));
+    piece_t x = p->board[sq];
 
-      ptype_t typ = ptype_of(x);
-      color_t color = color_of(x);
+    ptype_t typ = ptype_of(x);
 
-      switch (typ) {
-        case EMPTY:
-          break;
-        case PAWN:
-          if (laser_map[sq] == 1) continue;  // Piece is pinned down by laser.
-        case KING:
-          if (color != color_to_move) {  // Wrong color
-            break;
-          }
-          // directions
-          for (int d = 0; d < 8; d++) {
-            int dest = sq + dir_of(d);
-            // Skip moves into invalid squares
-            if (ptype_of(p->board[dest]) == INVALID) {
-              continue;    // illegal square
-            }
-
-            WHEN_DEBUG_VERBOSE(char buf[MAX_CHARS_IN_MOVE]);
-            WHEN_DEBUG_VERBOSE({
-                move_to_str(move_of(typ, (rot_t) 0, sq, dest), buf, MAX_CHARS_IN_MOVE);
-                DEBUG_LOG(1, "Before: %s ", buf);
-              });
-            tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
-            sortable_move_list[move_count++] = move_of(typ, (rot_t) 0, sq, dest);
-
-            WHEN_DEBUG_VERBOSE({
-                move_to_str(get_move(sortable_move_list[move_count-1]), buf, MAX_CHARS_IN_MOVE);
-                DEBUG_LOG(1, "After: %s\n", buf);
-              });
-          }
+    // Either all or none of the moves of a piece on touch qualify.  For the
+    // others it comes down to the destination.
+    bool on_touch = (touch & bb_of(sq)) != 0;
+    if (on_touch && !touching) {
+      continue;
+    }
 
-          // rotations - three directions possible
-          for (int rot = 1; rot < 4; ++rot) {
-            tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
-            sortable_move_list[move_count++] = move_of(typ, (rot_t) rot, sq, sq);
+    switch (typ) {
+      case PAWN:
+        if (enemy_laser & bb_of(sq)) continue;  // Piece is pinned down by laser.
+      case KING:
+        // directions
+        for (int d = 0; d < 8; d++) {
+          int dest = sq + dir_of(d);
+          // Skip moves into invalid squares
+          if (ptype_of(p->board[dest]) == INVALID) {
+            continue;    // illegal square
           }
-          if (typ == KING) {  // Also generate null move
-            tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
-            sortable_move_list[move_count++] = move_of(typ, (rot_t) 0, sq, sq);
+          if (!on_touch && ((touch & bb_of(dest)) != 0) != touching) {
+            continue;
           }
-          break;
-        case INVALID:
-        default:
-          tbassert(false, "Bogus, man.\n");  // Couldn't BE more bogus!
-      }
+
+          WHEN_DEBUG_VERBOSE(char buf[MAX_CHARS_IN_MOVE]);
+          WHEN_DEBUG_VERBOSE({
+              move_to_str(move_of(typ, (rot_t) 0, sq, dest), buf, MAX_CHARS_IN_MOVE);
+              DEBUG_LOG(1, "Before: %s ", buf);
+            });
+          tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
+          sortable_move_list[move_count++] = move_of(typ, (rot_t) 0, sq, dest);
+
+          WHEN_DEBUG_VERBOSE({
+              move_to_str(get_move(sortable_move_list[move_count-1]), buf, MAX_CHARS_IN_MOVE);
+              DEBUG_LOG(1, "After: %s\n", buf);
+            });
+        }
+
+        if (!on_touch && touching) {
+          break;  // rotations and null moves stay on sq
+        }
+
+        // rotations - three directions possible
+        for (int rot = 1; rot < 4; ++rot) {
+          tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
+          sortable_move_list[move_count++] = move_of(typ, (rot_t) rot, sq, sq);
+        }
+        if (typ == KING) {  // Also generate null move
+          tbassert(move_count < MAX_NUM_MOVES, "move_count: %d\n", move_count);
+          sortable_move_list[move_count++] = move_of(typ, (rot_t) 0, sq, sq);
+        }
+        break;
+      case EMPTY:
+      case INVALID:
+      default:
+        tbassert(false, "Bogus, man.\n");  // Couldn't BE more bogus!
     }
   }
 
@@ -361,50 +347,260 @@ int generate_all(position_t *p, sortable_move_t *sortable_move_list,
   return move_count;
 }
 
+// Generate all moves from position p.  Returns number of moves.
+// strict currently ignored
+//
+// https://chessprogramming.wikispaces.com/Move+Generation
+int generate_all(position_t *p, sortable_move_t *sortable_move_list,
+                 bool strict) {
+  return generate_moves(p, sortable_move_list, ~((bitboard_t) 0), true);
+}
+
+// A move can only zap a piece if it starts or ends on one of these squares:
+// those of the beam of the side to move, unless the beam already hits a piece,
+// in which case any move might.
+bitboard_t capture_squares(position_t *p) {
+  laser_t *l = &(p->laser[color_to_move_of(p)]);
+  return l->hit ? ~((bitboard_t) 0) : l->path;
+}
+
+// Generate the moves from position p that might zap a piece, a superset of the
+// captures.  Returns number of moves.
+int generate_captures(position_t *p, sortable_move_t *sortable_move_list) {
+  return generate_moves(p, sortable_move_list, capture_squares(p), true);
+}
+
+// Generate the moves from position p that cannot zap a piece, i.e., all the
+// moves that generate_captures() leaves out.  Returns number of moves.
+int generate_quiets(position_t *p, sortable_move_t *sortable_move_list) {
+  return generate_moves(p, sortable_move_list, capture_squares(p), false);
+}
+
+// Whether mv is one of the moves that generate_all() produces for p.  Moves
+// from elsewhere, like the hash table or killer moves, have to pass this before
+// they are played.
+bool is_pseudo_legal(position_t *p, move_t mv) {
+  color_t color_to_move = color_to_move_of(p);
+  square_t from_sq = from_square(mv);
+  square_t to_sq = to_square(mv);
+  ptype_t typ = ptype_mv_of(mv);
+  piece_t x = p->board[from_sq];
+
+  if ((typ != PAWN && typ != KING) || ptype_of(x) != typ ||
+      color_of(x) != color_to_move) {
+    return false;
+  }
+  if (typ == PAWN &&
+      (laser_path(p, opp_color(color_to_move)) & bb_of(from_sq))) {
+    return false;  // pinned down by laser
+  }
+  if (to_sq == from_sq) {
+    return rot_of(mv) != NONE || typ == KING;  // rotation or null move
+  }
+  if (rot_of(mv) != NONE || ptype_of(p->board[to_sq]) == INVALID) {
+    return false;
+  }
+  for (int d = 0; d < 8; d++) {
+    if (from_sq + dir_of(d) == to_sq) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // -----------------------------------------------------------------------------
 // Move execution
 // -----------------------------------------------------------------------------
 
+// Squares strictly beyond bit index i in laser direction d, out to the edge of
+// the board: ray[i][d]
+static bitboard_t ray[BB_SIZE][NUM_ORI];
+
+void init_laser_tables() {
+  for (int i = 0; i < BB_SIZE; i++) {
+    for (int d = 0; d < NUM_ORI; d++) {
+      square_t sq = bb_square(i);
+      bitboard_t r = 0;
+      while (true) {
+        sq += beam_of(d);
+        fil_t f = fil_of(sq);
+        rnk_t rk = rnk_of(sq);
+        if (f < 0 || f >= BOARD_WIDTH || rk < 0 || rk >= BOARD_WIDTH) {
+          break;
+        }
+        r |= bb_of(sq);
+      }
+      ray[i][d] = r;
+    }
+  }
+}
+
+// Squares after bit index from up to and including bit index to, which must
+// lie on ray[from][d]
+static inline bitboard_t ray_between(int from, int to, int d) {
+  return ray[from][d] & ~ray[to][d];
+}
+
+// Index of the bit of blockers closest to the origin of a beam in direction
+// d.  North and east beams run towards higher bit indices.
+static inline int nearest_blocker(bitboard_t blockers, int d) {
+  return (d == NN || d == EE) ? bb_lsb(blockers) : bb_msb(blockers);
+}
+
+// Squares lit by segment k of laser l, excluding its starting square
+static inline bitboard_t laser_seg_path(laser_t *l, int k) {
+  int start = l->seg_start[k];
+  int d = l->seg_dir[k];
+  if (k + 1 < l->num_segs) {
+    return ray_between(start, l->seg_start[k + 1], d);
+  }
+  if (l->hit) {
+    return ray_between(start, bb_index(l->hit), d);
+  }
+  return ray[start][d];
+}
+
+// Traces laser l as segment k starting on bit index i in direction bdir,
+// jumping from one piece to the next with the ray tables.  path holds the
+// squares lit by segments 0 through k - 1 and the King's square.
+static void trace_laser_from(position_t *p, laser_t *l, int k, int i,
+                             int bdir, bitboard_t path) {
+  bitboard_t occupied = p->bb_color[WHITE] | p->bb_color[BLACK];
+  square_t hit = 0;
+
+  while (true) {
+    tbassert(k < MAX_LASER_SEGS, "k: %d\n", k);
+    l->seg_start[k] = i;
+    l->seg_dir[k] = bdir;
+    k++;
+
+    bitboard_t blockers = ray[i][bdir] & occupied;
+    if (!blockers) {  // Ran off edge of board
+      path |= ray[i][bdir];
+      break;
+    }
+
+    int j = nearest_blocker(blockers, bdir);
+    path |= ray_between(i, j, bdir);
+    square_t sq = bb_square(j);
+    piece_t x = p->board[sq];
+
+    if (ptype_of(x) == KING) {  // sorry, game over my friend!
+      hit = sq;
+      break;
+    }
+    tbassert(ptype_of(x) == PAWN, "ptype: %d\n", ptype_of(x));
+    bdir = reflect_of(bdir, ori_of(x));
+    if (bdir < 0) {  // Hit back of Pawn
+      hit = sq;
+      break;
+    }
+    i = j;
+  }
+
+  l->num_segs = k;
+  l->path = path;
+  l->hit = hit;
+}
+
+// Traces the laser of the King of color c from scratch.
+static void trace_laser(position_t *p, color_t c) {
+  square_t sq = p->kloc[c];
+  tbassert(ptype_of(p->board[sq]) == KING,
+           "ptype: %d\n", ptype_of(p->board[sq]));
+  trace_laser_from(p, &p->laser[c], 0, bb_index(sq), ori_of(p->board[sq]),
+                   bb_of(sq));
+}
+
+void init_lasers(position_t *p) {
+  trace_laser(p, WHITE);
+  trace_laser(p, BLACK);
+}
+
+// Brings the cached laser of color c up to date after the contents of the
+// squares in touched changed.  Segments before the first one that passes over
+// a touched square are kept; the beam is retraced from there on.
+static void update_laser(position_t *p, color_t c, bitboard_t touched) {
+  laser_t *l = &p->laser[c];
+  if (!(l->path & touched)) {
+    return;  // beam is unaffected
+  }
+
+  bitboard_t path = ((bitboard_t) 1) << l->seg_start[0];
+  if (touched & path) {  // King moved or turned
+    trace_laser(p, c);
+    return;
+  }
+
+  for (int k = 0; k < l->num_segs; k++) {
+    bitboard_t seg = laser_seg_path(l, k);
+    if (seg & touched) {
+      trace_laser_from(p, l, k, l->seg_start[k], l->seg_dir[k], path);
+      return;
+    }
+    path |= seg;
+  }
+  tbassert(false, "touched square not found on laser path\n");
+}
+
+static inline void update_lasers(position_t *p, bitboard_t touched) {
+  update_laser(p, WHITE, touched);
+  update_laser(p, BLACK, touched);
+}
+
+// Debugging check that the cached lasers of p agree with fresh traces
+bool check_lasers(position_t *p) {
+  position_t q = *p;
+  init_lasers(&q);
+  for (int c = 0; c < 2; c++) {
+    if (q.laser[c].path != p->laser[c].path ||
+        q.laser[c].hit != p->laser[c].hit) {
+      return false;
+    }
+  }
+  return true;
+}
+
 // Returns the square of piece that would be zapped by the laser if fired once,
 // or 0 if no such piece exists.
 //
 // p : Current board state.
 // c : Color of king shooting laser.
 square_t fire_laser(position_t *p, color_t c) {
-  // color_t fake_color_to_move = (color_to_move_of(p) == WHITE) ? BLACK : WHITE;0
-  square_t sq = p->kloc[c];
-  int bdir = ori_of(p->board[sq]);
-
-  tbassert(ptype_of(p->board[sq]) == KING,
-           "ptype: %d\n", ptype_of(p->board[sq]));
+  return p->laser[c].hit;
+}
 
-  while (true) {
-    sq += beam_of(bdir);
-    tbassert(sq < ARR_SIZE && sq >= 0, "sq: %d\n", sq);
+// Returns the path/line-of-sight of the laser of the king of color c as a
+// bitboard, from the King's own square up to and including the square where
+// it hits a piece.
+bitboard_t laser_path(position_t *p, color_t c) {
+  return p->laser[c].path;
+}
 
-    switch (ptype_of(p->board[sq])) {
-      case EMPTY:  // empty square
-        break;
-      case PAWN:  // Pawn
-        bdir = reflect_of(bdir, ori_of(p->board[sq]));
-        if (bdir < 0) {  // Hit back of Pawn
-          return sq;
-        }
-        break;
-      case KING:  // King
-        return sq;  // sorry, game over my friend!
-        break;
-      case INVALID:  // Ran off edge of board
-        return 0;
-        break;
-      default:  // Shouldna happen, man!
-        tbassert(false, "Like porkchops and whipped cream.\n");
-        break;
-    }
+// Removes the piece on victim_sq, which was hit by a laser, from the board and
+// returns it.  The laser paths are left stale once a King goes: the game is
+// over.
+static inline piece_t zap(position_t *p, square_t victim_sq) {
+  piece_t victim_piece = p->board[victim_sq];
+  tbassert((ptype_of(victim_piece) != EMPTY) &&
+           (ptype_of(victim_piece) != INVALID),
+           "type: %d\n", ptype_of(victim_piece));
+
+  p->key ^= zob[victim_sq][victim_piece];
+  p->board[victim_sq] = 0;
+  p->key ^= zob[victim_sq][0];
+  bb_toggle(p, victim_sq, victim_piece);
+  bb_toggle(p, victim_sq, 0);
+
+  if (ptype_of(victim_piece) != KING) {
+    update_lasers(p, bb_of(victim_sq));
   }
+  return victim_piece;
 }
 
-void low_level_make_move(position_t *old, position_t *p, move_t mv) {
+// Moves the piece(s) of mv on p in place, without firing the laser, and saves
+// the pieces it disturbed in *u.
+static void move_pieces(position_t *p, move_t mv, undo_t *u) {
   tbassert(mv != 0, "mv was zero.\n");
 
   WHEN_DEBUG_VERBOSE(char buf[MAX_CHARS_IN_MOVE]);
@@ -413,13 +609,13 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
       DEBUG_LOG(1, "low_level_make_move: %s\n", buf);
     });
 
-  tbassert(old->key == compute_zob_key(old),
-           "old->key: %"PRIu64", zob-key: %"PRIu64"\n",
-           old->key, compute_zob_key(old));
+  tbassert(p->key == compute_zob_key(p),
+           "p->key: %"PRIu64", zob-key: %"PRIu64"\n",
+           p->key, compute_zob_key(p));
 
   WHEN_DEBUG_VERBOSE({
       fprintf(stderr, "Before:\n");
-      display(old);
+      display(p);
     });
 
   square_t from_sq = from_square(mv);
@@ -451,9 +647,6 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
       }
     });
 
-  *p = *old;
-
-  p->history = old;
   p->last_move = mv;
 
   tbassert(from_sq < ARR_SIZE && from_sq > 0, "from_sq: %d\n", from_sq);
@@ -467,6 +660,8 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
 
   piece_t from_piece = p->board[from_sq];
   piece_t to_piece = p->board[to_sq];
+  u->from_piece = from_piece;
+  u->to_piece = to_piece;
 
   if (to_sq != from_sq) {  // move, not rotation
     // Hash key updates
@@ -476,6 +671,11 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
     p->board[to_sq] = from_piece;  // swap from_piece and to_piece on board
     p->board[from_sq] = to_piece;
 
+    bb_toggle(p, from_sq, from_piece);  // ... and on the bitboards
+    bb_toggle(p, to_sq, to_piece);
+    bb_toggle(p, to_sq, from_piece);
+    bb_toggle(p, from_sq, to_piece);
+
     p->key ^= zob[to_sq][from_piece];  // place from_piece in to_sq
     p->key ^= zob[from_sq][to_piece];  // place to_piece in from_sq
 
@@ -487,12 +687,18 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
       p->kloc[color_of(to_piece)] = from_sq;
     }
 
+    update_lasers(p, bb_of(from_sq) | bb_of(to_sq));
+
   } else {  // rotation
     // remove from_piece from from_sq in hash
     p->key ^= zob[from_sq][from_piece];
+    bb_toggle(p, from_sq, from_piece);
     set_ori(&from_piece, rot + ori_of(from_piece));  // rotate from_piece
     p->board[from_sq] = from_piece;  // place rotated piece on board
     p->key ^= zob[from_sq][from_piece];              // ... and in hash
+    bb_toggle(p, from_sq, from_piece);               // ... and on bitboards
+
+    update_lasers(p, bb_of(from_sq));
   }
 
   // Increment ply
@@ -501,6 +707,8 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
   tbassert(p->key == compute_zob_key(p),
            "p->key: %"PRIu64", zob-key: %"PRIu64"\n",
            p->key, compute_zob_key(p));
+  tbassert(check_bitboards(p), "bitboards out of sync with board\n");
+  tbassert(check_lasers(p), "laser paths out of sync with board\n");
 
   WHEN_DEBUG_VERBOSE({
       fprintf(stderr, "After:\n");
@@ -508,35 +716,77 @@ void low_level_make_move(position_t *old, position_t *p, move_t mv) {
     });
 }
 
-// return victim pieces or KO
-victims_t make_move(position_t *old, position_t *p, move_t mv) {
-  tbassert(mv != 0, "mv was zero.\n");
+// The key of p after mv, provided that mv zaps nothing.  This takes only the
+// hash updates of move_pieces(), so the search can prefetch the transposition
+// table entries of a position before it plays the move that leads there.
+uint64_t key_after_move(position_t *p, move_t mv) {
+  square_t from_sq = from_square(mv);
+  square_t to_sq = to_square(mv);
+  piece_t from_piece = p->board[from_sq];
+  uint64_t key = p->key ^ zob_color;
 
+  if (to_sq != from_sq) {  // move, not rotation
+    piece_t to_piece = p->board[to_sq];
+    key ^= zob[from_sq][from_piece] ^ zob[to_sq][to_piece];
+    key ^= zob[to_sq][from_piece] ^ zob[from_sq][to_piece];
+  } else {  // rotation
+    piece_t rotated = from_piece;
+    set_ori(&rotated, rot_of(mv) + ori_of(from_piece));
+    key ^= zob[from_sq][from_piece] ^ zob[from_sq][rotated];
+  }
+  return key;
+}
+
+void low_level_make_move(position_t *old, position_t *p, move_t mv) {
+  undo_t u;
+  *p = *old;
+  p->history = old;
+  move_pieces(p, mv, &u);
+}
+
+// Plays mv on p in place and returns the victim pieces, or KO if the move left
+// the board unchanged.  Everything undo_move() needs to take the move back is
+// saved in *u; this has to happen even for a KO move.
+//
+// Only the first half of the Ko rule is checked here: repeating the position
+// from before the opponent's last move needs the key history of the caller.
+victims_t do_move(position_t *p, move_t mv, undo_t *u) {
   WHEN_DEBUG_VERBOSE(char buf[MAX_CHARS_IN_MOVE]);
 
+  color_t c = color_to_move_of(p);
+
+  u->key = p->key;
+  u->last_move = p->last_move;
+  u->victims = p->victims;
+  u->kloc[WHITE] = p->kloc[WHITE];
+  u->kloc[BLACK] = p->kloc[BLACK];
+  u->laser[WHITE] = p->laser[WHITE];
+  u->laser[BLACK] = p->laser[BLACK];
+
   // move phase 1 - moving a piece
-  low_level_make_move(old, p, mv);
+  move_pieces(p, mv, u);
 
   // move phase 2 - shooting the laser
   square_t victim_sq = 0;
   p->victims.zapped_count = 0;
 
-  while ((victim_sq = fire_laser(p, color_to_move_of(old)))) {
+  while ((victim_sq = fire_laser(p, c))) {
     WHEN_DEBUG_VERBOSE({
         square_to_str(victim_sq, buf, MAX_CHARS_IN_MOVE);
         DEBUG_LOG(1, "Zapping piece on %s\n", buf);
       });
 
     // we definitely hit something with laser, remove it from board
-    piece_t victim_piece = p->board[victim_sq];
+    piece_t victim_piece = zap(p, victim_sq);
+    u->zapped_sq[p->victims.zapped_count] = victim_sq;
     p->victims.zapped[p->victims.zapped_count++] = victim_piece;
-    p->key ^= zob[victim_sq][victim_piece];
-    p->board[victim_sq] = 0;
-    p->key ^= zob[victim_sq][0];
 
     tbassert(p->key == compute_zob_key(p),
              "p->key: %"PRIu64", zob-key: %"PRIu64"\n",
              p->key, compute_zob_key(p));
+    tbassert(check_bitboards(p), "bitboards out of sync with board\n");
+    tbassert(ptype_of(victim_piece) == KING || check_lasers(p),
+             "laser paths out of sync with board\n");
 
     WHEN_DEBUG_VERBOSE({
         square_to_str(victim_sq, buf, MAX_CHARS_IN_MOVE);
@@ -547,113 +797,259 @@ victims_t make_move(position_t *old, position_t *p, move_t mv) {
     if (ptype_of(victim_piece) == KING) break;
   }
 
-  if (USE_KO) {  // Ko rule
-    if (p->key == (old->key ^ zob_color)) {
-      bool match = true;
+  // Ko rule: the board is unchanged exactly when nothing was zapped and the
+  // move either did nothing or swapped two identical pieces.
+  if (USE_KO && p->victims.zapped_count == 0) {
+    square_t from_sq = from_square(mv);
+    square_t to_sq = to_square(mv);
+    if (from_sq == to_sq ? rot_of(mv) == NONE : u->from_piece == u->to_piece) {
+      return KO();
+    }
+  }
 
-      for (fil_t f = 0; f < BOARD_WIDTH; f++) {
-        for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
-          if (p->board[square_of(f, r)] !=
-              old->board[square_of(f, r)]) {
-            match = false;
-          }
-        }
-      }
+  return p->victims;
+}
 
-      if (match) return KO();
-    }
+// Takes back the last move played on p by do_move(), given the same *u.
+void undo_move(position_t *p, undo_t *u) {
+  move_t mv = p->last_move;
+  square_t from_sq = from_square(mv);
+  square_t to_sq = to_square(mv);
 
-    if (p->key == old->history->key) {
-      bool match = true;
+  // put the victims back, last one first
+  for (int i = p->victims.zapped_count - 1; i >= 0; i--) {
+    square_t sq = u->zapped_sq[i];
+    piece_t victim_piece = p->victims.zapped[i];
+    p->board[sq] = victim_piece;
+    bb_toggle(p, sq, 0);
+    bb_toggle(p, sq, victim_piece);
+  }
 
-      for (fil_t f = 0; f < BOARD_WIDTH; f++) {
-        for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
-          if (p->board[square_of(f, r)] !=
-              old->history->board[square_of(f, r)]) {
-            match = false;
-          }
-        }
-      }
+  // then the pieces that moved
+  bb_toggle(p, from_sq, p->board[from_sq]);
+  bb_toggle(p, from_sq, u->from_piece);
+  p->board[from_sq] = u->from_piece;
+  if (to_sq != from_sq) {
+    bb_toggle(p, to_sq, p->board[to_sq]);
+    bb_toggle(p, to_sq, u->to_piece);
+    p->board[to_sq] = u->to_piece;
+  }
+
+  p->key = u->key;
+  p->ply--;
+  p->last_move = u->last_move;
+  p->victims = u->victims;
+  p->kloc[WHITE] = u->kloc[WHITE];
+  p->kloc[BLACK] = u->kloc[BLACK];
+  p->laser[WHITE] = u->laser[WHITE];
+  p->laser[BLACK] = u->laser[BLACK];
 
-      if (match) return KO();
+  tbassert(p->key == compute_zob_key(p),
+           "p->key: %"PRIu64", zob-key: %"PRIu64"\n",
+           p->key, compute_zob_key(p));
+  tbassert(check_bitboards(p), "bitboards out of sync with board\n");
+  tbassert(check_lasers(p), "laser paths out of sync with board\n");
+}
+
+// return victim pieces or KO
+victims_t make_move(position_t *old, position_t *p, move_t mv) {
+  undo_t u;
+  *p = *old;
+  p->history = old;
+
+  victims_t victims = do_move(p, mv, &u);
+
+  if (USE_KO && !is_KO(victims)) {  // the other half of the Ko rule
+    if (p->key == old->history->key && same_board(p, old->history)) {
+      return KO();
     }
   }
 
-  return p->victims;
+  return victims;
 }
 
 // -----------------------------------------------------------------------------
 // Move path enumeration (perft)
 // -----------------------------------------------------------------------------
 
-// Helper function for do_perft() (ply starting with 0).
+// Perft ignores the Ko rule, so the number of paths below a position only
+// depends on the board and the side to move, which is exactly what its key
+// covers.  Subtree counts can thus be cached by key and depth.
 //
-// NOTE: This function reimplements some of the logic for make_move().
-static uint64_t perft_search(position_t *p, int depth, int ply) {
-  uint64_t node_count = 0;
-  position_t np;
-  sortable_move_t lst[MAX_NUM_MOVES];
-  int num_moves;
-  int i;
+// Like the records of the transposition table (see tt.c), an entry holds its
+// key XOR-ed with its data, so that threads share the cache without locking:
+// an entry torn by two writers fails the check and is just a miss.
+typedef struct {
+  uint64_t check;  // key ^ data
+  uint64_t data;   // (count << PERFT_DEPTH_BITS) | depth
+} perft_entry_t;
+
+#define PERFT_DEPTH_BITS 8
+#define PERFT_DEPTH_MASK ((1 << PERFT_DEPTH_BITS) - 1)
+
+static perft_entry_t *perft_cache = NULL;  // NULL if not caching
+static uint64_t perft_cache_mask;
+
+static uint64_t perft_search(position_t *p, int depth);
+
+// Reads an entry that other threads may be writing at the same time.  Returns
+// its data if it holds the count of key at depth, or 0 if not; the data of a
+// hit is never 0, since it includes the depth.
+static inline uint64_t perft_read(perft_entry_t *entry, uint64_t key,
+                                  int depth) {
+  uint64_t check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+  uint64_t data = __atomic_load_n(&entry->data, __ATOMIC_RELAXED);
+  if ((check ^ data) != key || (data & PERFT_DEPTH_MASK) != depth) {
+    return 0;
+  }
+  return data;
+}
+
+static inline void perft_write(perft_entry_t *entry, uint64_t key,
+                               uint64_t data) {
+  __atomic_store_n(&entry->check, key ^ data, __ATOMIC_RELAXED);
+  __atomic_store_n(&entry->data, data, __ATOMIC_RELAXED);
+}
+
+// Plays mv on p, counts the paths of length depth - 1 after it, and takes mv
+// back.  A path ends early if its last move zaps a King.
+static uint64_t perft_move(position_t *p, move_t mv, int depth) {
+  undo_t u;
+  do_move(p, mv, &u);  // Ko moves count like any other
 
+  uint64_t node_count;
+  if (p->victims.zapped_count > 0 &&
+      ptype_of(p->victims.zapped[p->victims.zapped_count - 1]) == KING) {
+    node_count = 1;  // do not expand further: hit a King
+  } else {
+    node_count = perft_search(p, depth - 1);
+  }
+
+  undo_move(p, &u);
+  return node_count;
+}
+
+// Counts the paths of length depth from p.
+static uint64_t perft_search(position_t *p, int depth) {
   if (depth == 0) {
     return 1;
   }
 
-  num_moves = generate_all(p, lst, true);
+  // Counting the moves is cheaper than a cache miss, so only look up deeper
+  // subtrees.
+  perft_entry_t *entry = NULL;
+  if (perft_cache != NULL && depth >= 2) {
+    entry = &perft_cache[p->key & perft_cache_mask];
+    uint64_t data = perft_read(entry, p->key, depth);
+    if (data != 0) {
+      return data >> PERFT_DEPTH_BITS;
+    }
+  }
+
+  sortable_move_t lst[MAX_NUM_MOVES];
+  int num_moves = generate_all(p, lst, true);
 
   if (depth == 1) {
     return num_moves;
   }
 
-  for (i = 0; i < num_moves; i++) {
-    move_t mv = get_move(lst[i]);
-
-    low_level_make_move(p, &np, mv);  // make the move baby!
-
-    square_t victim_sq = 0;  // the guys to disappear
-    np.victims.zapped_count = 0;
+  uint64_t node_count = 0;
+  for (int i = 0; i < num_moves; i++) {
+    node_count += perft_move(p, get_move(lst[i]), depth);
+  }
 
-    while ((victim_sq = fire_laser(&np, color_to_move_of(p)))) {  // hit a piece
-      piece_t victim_piece = np.board[victim_sq];
-      tbassert((ptype_of(victim_piece) != EMPTY) &&
-               (ptype_of(victim_piece) != INVALID),
-               "type: %d\n", ptype_of(victim_piece));
+  if (entry != NULL) {
+    perft_write(entry, p->key, (node_count << PERFT_DEPTH_BITS) | depth);
+  }
+  return node_count;
+}
 
-      np.victims.zapped[np.victims.zapped_count++] = victim_piece;
-      np.key ^= zob[victim_sq][victim_piece];   // remove from board
-      np.board[victim_sq] = 0;
-      np.key ^= zob[victim_sq][0];
+// Counts the paths of length depth below each of the moves in lst into counts.
+// Under PARALLEL, the moves are counted in parallel, each on its own copy of p.
+static uint64_t perft_root(position_t *p, int depth, sortable_move_t *lst,
+                           int num_moves, uint64_t *counts) {
+#if PARALLEL
+  cilk_for (int i = 0; i < num_moves; i++) {
+    position_t np = *p;
+    counts[i] = perft_move(&np, get_move(lst[i]), depth);
+  }
+#else
+  for (int i = 0; i < num_moves; i++) {
+    counts[i] = perft_move(p, get_move(lst[i]), depth);
+  }
+#endif
 
-      if (ptype_of(victim_piece) == KING) break;
-    }
+  uint64_t node_count = 0;
+  for (int i = 0; i < num_moves; i++) {
+    node_count += counts[i];
+  }
+  return node_count;
+}
 
-    if (np.victims.zapped_count > 0 &&
-        ptype_of(np.victims.zapped[np.victims.zapped_count - 1]) == KING) {
-      // do not expand further: hit a King
-      node_count++;
-      continue;
-    }
+// Sets up a cache of about hash_mb MBytes, or none if hash_mb is 0.
+static void perft_cache_make(int hash_mb) {
+  perft_cache = NULL;
+  if (hash_mb <= 0) {
+    return;
+  }
 
-    uint64_t partialcount = perft_search(&np, depth-1, ply+1);
-    node_count += partialcount;
+  uint64_t num_of_entries = 1;
+  while (2 * num_of_entries * sizeof(perft_entry_t) <=
+         (uint64_t) hash_mb << 20) {
+    num_of_entries *= 2;
+  }
+  perft_cache = (perft_entry_t *) calloc(num_of_entries, sizeof(perft_entry_t));
+  if (perft_cache == NULL) {
+    fprintf(stderr, "No memory for a perft cache of %d MBytes.\n", hash_mb);
+    return;
   }
+  perft_cache_mask = num_of_entries - 1;
+}
 
-  return node_count;
+static void perft_cache_free() {
+  free(perft_cache);
+  perft_cache = NULL;
 }
 
 // Debugging function to help verify that the move generator is working
-// correctly.
+// correctly, and to measure its speed.  Counts the paths of each length up to
+// depth from p, or with divide, those of length depth below each of its moves.
+// hash_mb is the size of the cache of subtree counts; 0 turns it off.
 //
 // https://chessprogramming.wikispaces.com/Perft
-void do_perft(position_t *gme, int depth, int ply) {
-  fen_to_pos(gme, "");
+void do_perft(position_t *p, int depth, int hash_mb, bool divide) {
+  sortable_move_t lst[MAX_NUM_MOVES];
+  uint64_t counts[MAX_NUM_MOVES];
+  char buf[MAX_CHARS_IN_MOVE];
+  int num_moves = generate_all(p, lst, true);
+  uint64_t node_count = 0;
+  double et = 0;
 
-  for (int d = 1; d <= depth; d++) {
-    printf("perft %2d ", d);
-    uint64_t j = perft_search(gme, d, 0);
-    printf("%" PRIu64 "\n", j);
+  perft_cache_make(hash_mb);
+
+  for (int d = divide ? depth : 1; d <= depth; d++) {
+    double start = milliseconds();
+    node_count = perft_root(p, d, lst, num_moves, counts);
+    et = milliseconds() - start;
+
+    if (divide) {
+      for (int i = 0; i < num_moves; i++) {
+        move_to_str(get_move(lst[i]), buf, MAX_CHARS_IN_MOVE);
+        printf("%s %" PRIu64 "\n", buf, counts[i]);
+      }
+    } else {
+      printf("perft %2d %" PRIu64 "\n", d, node_count);
+    }
   }
+
+  perft_cache_free();
+
+  if (et < 1) {
+    et = 1;  // do not divide by 0
+  }
+  printf("info perft depth %d moves %d nodes %" PRIu64 " time (ms) %d nps %"
+         PRIu64 "\n", depth, num_moves, node_count, (int) et,
+         (uint64_t) (1000 * node_count / et));
 }
 
 // -----------------------------------------------------------------------------
@@ -715,31 +1111,3 @@ void display(position_t *p) {
   }
   printf("\n\n");
 }
-
-// -----------------------------------------------------------------------------
-// Ko and illegal move signalling
-// -----------------------------------------------------------------------------
-
-victims_t KO() {
-  return ((victims_t) {KO_ZAPPED, {0}});
-}
-
-victims_t ILLEGAL() {
-  return ((victims_t) {ILLEGAL_ZAPPED, {0}});
-}
-
-bool is_KO(victims_t victims) {
-  return (victims.zapped_count == KO_ZAPPED);
-}
-
-bool is_ILLEGAL(victims_t victims) {
-  return (victims.zapped_count == ILLEGAL_ZAPPED);
-}
-
-bool zero_victims(victims_t victims) {
-  return (victims.zapped_count == 0);
-}
-
-bool victim_exists(victims_t victims) {
-  return (victims.zapped_count > 0);
-}
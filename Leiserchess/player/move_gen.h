@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#include "./tbassert.h"
+
 #define MAX_NUM_MOVES 128      // real number = 7 x (8 + 3) + 1 x (8 + 4) = 89
 #define MAX_PLY_IN_SEARCH 100  // up to 100 ply
 #define MAX_PLY_IN_GAME 4096   // long game!  ;^)
@@ -45,7 +47,8 @@ typedef int fil_t;
 
 #define PIECE_SIZE 5  // Number of bits in (ptype, color, orientation)
 
-typedef int piece_t;
+// A piece fits in a byte, so the board takes ARR_SIZE bytes.
+typedef uint8_t piece_t;
 
 // -----------------------------------------------------------------------------
 // Piece types
@@ -95,6 +98,42 @@ typedef enum {
   SW
 } pawn_ori_t;
 
+// -----------------------------------------------------------------------------
+// Piece getters and setters (including color, ptype, orientation)
+// -----------------------------------------------------------------------------
+
+static inline color_t color_of(piece_t x) {
+  return (color_t) ((x >> COLOR_SHIFT) & COLOR_MASK);
+}
+
+static inline color_t opp_color(color_t c) {
+  return (color_t) (c ^ 1);
+}
+
+static inline void set_color(piece_t *x, color_t c) {
+  tbassert((c >= 0) & (c <= COLOR_MASK), "color: %d\n", c);
+  *x = ((c & COLOR_MASK) << COLOR_SHIFT) |
+      (*x & ~(COLOR_MASK << COLOR_SHIFT));
+}
+
+static inline ptype_t ptype_of(piece_t x) {
+  return (ptype_t) ((x >> PTYPE_SHIFT) & PTYPE_MASK);
+}
+
+static inline void set_ptype(piece_t *x, ptype_t pt) {
+  *x = ((pt & PTYPE_MASK) << PTYPE_SHIFT) |
+      (*x & ~(PTYPE_MASK << PTYPE_SHIFT));
+}
+
+static inline int ori_of(piece_t x) {
+  return (x >> ORI_SHIFT) & ORI_MASK;
+}
+
+static inline void set_ori(piece_t *x, int ori) {
+  *x = ((ori & ORI_MASK) << ORI_SHIFT) |
+      (*x & ~(ORI_MASK << ORI_SHIFT));
+}
+
 // -----------------------------------------------------------------------------
 // Moves
 // -----------------------------------------------------------------------------
@@ -122,10 +161,42 @@ typedef enum {
   LEFT
 } rot_t;
 
+static inline ptype_t ptype_mv_of(move_t mv) {
+  return (ptype_t) ((mv >> PTYPE_MV_SHIFT) & PTYPE_MV_MASK);
+}
+
+static inline square_t from_square(move_t mv) {
+  return (mv >> FROM_SHIFT) & FROM_MASK;
+}
+
+static inline square_t to_square(move_t mv) {
+  return (mv >> TO_SHIFT) & TO_MASK;
+}
+
+static inline rot_t rot_of(move_t mv) {
+  return (rot_t) ((mv >> ROT_SHIFT) & ROT_MASK);
+}
+
+static inline move_t move_of(ptype_t typ, rot_t rot, square_t from_sq,
+                             square_t to_sq) {
+  return ((typ & PTYPE_MV_MASK) << PTYPE_MV_SHIFT) |
+      ((rot & ROT_MASK) << ROT_SHIFT) |
+      ((from_sq & FROM_MASK) << FROM_SHIFT) |
+      ((to_sq & TO_MASK) << TO_SHIFT);
+}
+
+// -----------------------------------------------------------------------------
+// Victims
+// -----------------------------------------------------------------------------
+
 // A single move can zap up to 13 pieces.
+#define MAX_VICTIMS 13
+
+// The pieces a move zapped, in the order the laser hit them.  At 14 bytes it
+// is cheap to return by value.
 typedef struct victims_t {
-  int zapped_count;
-  piece_t zapped[13];
+  int8_t  zapped_count;
+  piece_t zapped[MAX_VICTIMS];
 } victims_t;
 
 // returned by make move in illegal situation
@@ -133,10 +204,129 @@ typedef struct victims_t {
 // returned by make move in ko situation
 #define ILLEGAL_ZAPPED -1
 
+static inline victims_t KO() {
+  return ((victims_t) {KO_ZAPPED, {0}});
+}
+
+static inline victims_t ILLEGAL() {
+  return ((victims_t) {ILLEGAL_ZAPPED, {0}});
+}
+
+static inline bool is_KO(victims_t victims) {
+  return (victims.zapped_count == KO_ZAPPED);
+}
+
+static inline bool is_ILLEGAL(victims_t victims) {
+  return (victims.zapped_count == ILLEGAL_ZAPPED);
+}
+
+static inline bool zero_victims(victims_t victims) {
+  return (victims.zapped_count == 0);
+}
+
+static inline bool victim_exists(victims_t victims) {
+  return (victims.zapped_count > 0);
+}
+
+// -----------------------------------------------------------------------------
+// Bitboards
+// -----------------------------------------------------------------------------
+
+// Bitboards shadow the mailbox with one bit per playable square.  Square
+// (f, r) maps to bit f * BOARD_WIDTH + r, so visiting the bits of a bitboard
+// from low to high walks the squares in the same order as the nested
+// for (fil_t f ...) for (rnk_t r ...) loops over the mailbox.
+//
+// https://chessprogramming.wikispaces.com/Bitboards
+
+#define BB_SIZE (BOARD_WIDTH * BOARD_WIDTH)
+
+#if BB_SIZE <= 64
+typedef uint64_t bitboard_t;
+#else
+typedef unsigned __int128 bitboard_t;  // 10 x 10 board
+#endif
+
+// bit index of an on-board square
+static inline int bb_index(square_t sq) {
+  return (((sq >> FIL_SHIFT) & FIL_MASK) - FIL_ORIGIN) * BOARD_WIDTH +
+      (((sq >> RNK_SHIFT) & RNK_MASK) - RNK_ORIGIN);
+}
+
+// square of a bit index
+static inline square_t bb_square(int i) {
+  return ARR_WIDTH * (FIL_ORIGIN + i / BOARD_WIDTH) + RNK_ORIGIN +
+      i % BOARD_WIDTH;
+}
+
+// bitboard with only the bit of on-board square sq set
+static inline bitboard_t bb_of(square_t sq) {
+  return ((bitboard_t) 1) << bb_index(sq);
+}
+
+static inline int bb_popcount(bitboard_t bb) {
+#if BB_SIZE <= 64
+  return __builtin_popcountll(bb);
+#else
+  return __builtin_popcountll((uint64_t) bb) +
+      __builtin_popcountll((uint64_t) (bb >> 64));
+#endif
+}
+
+// index of the lowest set bit; bb must be nonzero
+static inline int bb_lsb(bitboard_t bb) {
+#if BB_SIZE <= 64
+  return __builtin_ctzll(bb);
+#else
+  uint64_t lo = (uint64_t) bb;
+  return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll((uint64_t) (bb >> 64));
+#endif
+}
+
+// index of the highest set bit; bb must be nonzero
+static inline int bb_msb(bitboard_t bb) {
+#if BB_SIZE <= 64
+  return 63 - __builtin_clzll(bb);
+#else
+  uint64_t hi = (uint64_t) (bb >> 64);
+  return hi ? 127 - __builtin_clzll(hi) : 63 - __builtin_clzll((uint64_t) bb);
+#endif
+}
+
+// -----------------------------------------------------------------------------
+// Lasers
+// -----------------------------------------------------------------------------
+
+// Each position caches the path of both Kings' lasers as a list of straight
+// segments.  Segment k starts on the square of the King (k = 0) or of the Pawn
+// that reflected the beam into it, and runs in direction seg_dir[k] up to the
+// next reflecting Pawn, the piece that stops the beam, or the edge of the
+// board.  A move only retraces the beam from the first segment it touches.
+//
+// Every segment after the first starts at a different Pawn: a beam never
+// travels the same way between two squares twice, and a Pawn that reflected
+// it once could only reflect it again on a beam coming back the way it left.
+// Pawns are never added, and fen_to_pos refuses positions with more than
+// MAX_PAWNS, so MAX_PAWNS + 1 segments suffice.
+#define MAX_PAWNS 14  // 7 of each color in the opening position
+#define MAX_LASER_SEGS (MAX_PAWNS + 1)
+
+typedef struct laser {
+  bitboard_t path;      // lit squares, including the King's and hit squares
+  square_t   hit;       // square of the piece that stops the beam, or 0
+  int        num_segs;  // number of segments
+  uint8_t    seg_start[MAX_LASER_SEGS];  // bit index where segment k starts
+  uint8_t    seg_dir[MAX_LASER_SEGS];    // beam direction of segment k
+} laser_t;
+
 // -----------------------------------------------------------------------------
 // Position
 // -----------------------------------------------------------------------------
 
+// Static evaluation of a Pawn on each square (by bit index): its material plus
+// its PCENTRAL bonus.  Filled in by init_eval_tables() in eval.c.
+extern int32_t pawn_square_ev[BB_SIZE];
+
 // Board representation is square-centric with sentinels.
 //
 // https://chessprogramming.wikispaces.com/Board+Representation
@@ -151,24 +341,45 @@ typedef struct position {
   move_t       last_move;        // move that led to this position
   victims_t    victims;          // pieces destroyed by shooter
   square_t     kloc[2];          // location of kings
+  bitboard_t   bb_color[2];      // squares occupied by each color
+  bitboard_t   bb_ptype[INVALID];  // squares holding each ptype (EMPTY too)
+  bitboard_t   bb_ori[NUM_ORI];  // squares holding a piece of each orientation
+  laser_t      laser[2];         // laser path of each King
+  int32_t      pawn_ev[2];       // sum of pawn_square_ev over each side's Pawns
 } position_t;
 
+// Everything undo_move() needs to take back a move played by do_move().  The
+// search keeps one per ply on the stack instead of copying whole positions.
+typedef struct undo {
+  uint64_t     key;                     // hash key before the move
+  move_t       last_move;               // last_move before the move
+  victims_t    victims;                 // victims before the move
+  square_t     kloc[2];                 // King locations before the move
+  piece_t      from_piece;              // pieces on the from and to squares
+  piece_t      to_piece;                //   before the move
+  uint8_t      zapped_sq[MAX_VICTIMS];  // squares of the move's victims
+  laser_t      laser[2];                // laser paths before the move
+} undo_t;
+
+// which color is moving next
+static inline color_t color_to_move_of(position_t *p) {
+  return (color_t) (p->ply & 1);
+}
+
 // -----------------------------------------------------------------------------
 // Function prototypes
 // -----------------------------------------------------------------------------
 
 char *color_to_str(color_t c);
-color_t color_to_move_of(position_t *p);
-color_t color_of(piece_t x);
-color_t opp_color(color_t c);
-void set_color(piece_t *x, color_t c);
-ptype_t ptype_of(piece_t x);
-void set_ptype(piece_t *x, ptype_t pt);
-int ori_of(piece_t x);
-void set_ori(piece_t *x, int ori);
 
 void init_zob();
 uint64_t compute_zob_key(position_t *p);
+void init_bitboards(position_t *p);
+bool check_bitboards(position_t *p);
+void init_pawn_ev(position_t *p);
+void init_laser_tables();
+void init_lasers(position_t *p);
+bool check_lasers(position_t *p);
 
 square_t square_of(fil_t f, rnk_t r);
 fil_t fil_of(square_t sq);
@@ -179,26 +390,21 @@ int dir_of(int i);
 int beam_of(int direction);
 int reflect_of(int beam_dir, int pawn_ori);
 
-ptype_t ptype_mv_of(move_t mv);
-square_t from_square(move_t mv);
-square_t to_square(move_t mv);
-rot_t rot_of(move_t mv);
-move_t move_of(ptype_t typ, rot_t rot, square_t from_sq, square_t to_sq);
 void move_to_str(move_t mv, char *buf, size_t bufsize);
 
 int generate_all(position_t *p, sortable_move_t *sortable_move_list,
                  bool strict);
-void do_perft(position_t *gme, int depth, int ply);
+bitboard_t capture_squares(position_t *p);
+int generate_captures(position_t *p, sortable_move_t *sortable_move_list);
+int generate_quiets(position_t *p, sortable_move_t *sortable_move_list);
+bool is_pseudo_legal(position_t *p, move_t mv);
+bitboard_t laser_path(position_t *p, color_t c);
+void do_perft(position_t *p, int depth, int hash_mb, bool divide);
+uint64_t key_after_move(position_t *p, move_t mv);
 void low_level_make_move(position_t *old, position_t *p, move_t mv);
 victims_t make_move(position_t *old, position_t *p, move_t mv);
+victims_t do_move(position_t *p, move_t mv, undo_t *u);
+void undo_move(position_t *p, undo_t *u);
 void display(position_t *p);
 
-victims_t KO();
-victims_t ILLEGAL();
-
-bool is_ILLEGAL(victims_t victims);
-bool is_KO(victims_t victims);
-bool zero_victims(victims_t victims);
-bool victim_exists(victims_t victims);
-
 #endif  // MOVE_GEN_H
@@ -21,6 +21,7 @@ implementation has been provided for you.
 #include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 #include <pthread.h>
 #include <cilk/cilk.h>
 #include <cilk/reducer.h>
@@ -29,9 +30,11 @@ implementation has been provided for you.
 #include <inttypes.h>
 
 #include "./eval.h"
+#include "./tablebase.h"
 #include "./tt.h"
 #include "./util.h"
 #include "./fen.h"
+#include "./stats.h"
 #include "./tbassert.h"
 
 
@@ -41,6 +44,20 @@ implementation has been provided for you.
 
 #define ABORT_CHECK_PERIOD 0xfff
 
+// scout_search only spawns younger brothers in parallel at this depth and
+// above; shallower subtrees are too small to pay for the spawn.
+#define YBW_DEPTH 3
+
+// scout_search tries a null move from NULL_DEPTH on, and reduces the search of
+// it by one more ply for every NULL_R_DEPTH of depth beyond.  Shallower null
+// move searches end up in quiescence, which is blind to the quiet moves that
+// line up a laser, and so prune far too much.
+#define NULL_DEPTH 5
+#define NULL_R_DEPTH 4
+
+// lmr_table covers depths up to here; deeper nodes use its last row.
+#define LMR_DEPTHS 64
+
 // -----------------------------------------------------------------------------
 // READ ONLY settings (see iopt in leiserchess.c)
 // -----------------------------------------------------------------------------
@@ -54,20 +71,29 @@ int HMB;  // having the move bonus
 // Late-move reduction
 int LMR_R1;    // Look at this number of moves full width before reducing 1 ply
 int LMR_R2;    // After this number of moves reduce 2 ply
+int LMR_SCALE;  // and a further ln(depth) * ln(moves) * LMR_SCALE / 100 ply
+
+// Null-move pruning
+int USE_NULL;     // Try a null move in scout search
+int NULL_R;       // Reduce the null-move search by this many ply, and more deeper
+int NULL_VERIFY;  // Verify null-move cut-offs from this depth on
 
 int USE_NMM;       // Null move margin
 int TRACE_MOVES;   // Print moves
 int DETECT_DRAWS;  // Detect draws by repetition
+int USE_YBW;       // Search younger brothers in parallel (PARALLEL builds only)
+int USE_TB;        // Probe the endgame tablebases (see tablebase.c)
+
+extern int USE_KO;  // Respect the Ko rule (see move_gen.c)
 
 // do not set more than 5 ply
 int FUT_DEPTH;     // set to zero for no futilty
 
 
 // Declare the two main search functions.
-static score_t searchPV(searchNode *node, int depth,
-                        uint64_t *node_count_serial);
+static score_t searchPV(searchNode *node, int depth, search_context_t *ctx);
 static score_t scout_search(searchNode *node, int depth,
-                            uint64_t *node_count_serial);
+                            search_context_t *ctx);
 
 // Include common search functions
 #include "./search_globals.c"
@@ -85,7 +111,7 @@ static void initialize_pv_node(searchNode* node, int depth) {
   node->depth = depth;
   node->legal_move_count = 0;
   node->ply = node->parent->ply + 1;
-  node->fake_color_to_move = color_to_move_of(&(node->position));
+  node->fake_color_to_move = color_to_move_of(&(node->sp->pos));
   // point of view = 1 for white, -1 for black
   node->pov = 1 - node->fake_color_to_move * 2;
   node->quiescence = (depth <= 0);
@@ -97,9 +123,10 @@ static void initialize_pv_node(searchNode* node, int depth) {
 // Perform a Principle Variation Search
 //
 // https://chessprogramming.wikispaces.com/Principal+Variation+Search
-static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial) {
+static score_t searchPV(searchNode *node, int depth, search_context_t *ctx) {
   // Initialize the searchNode data structure.
   initialize_pv_node(node, depth);
+  STATS_NODE(depth);
 
   // Pre-evaluate the node to determine if we need to search further.
   leafEvalResult pre_evaluation_result = evaluate_as_leaf(node, SEARCH_PV);
@@ -118,15 +145,16 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
   }
 
   // Get the killer moves at this node.
-  move_t killer_a = killer[KMT(node->ply, 0)];
-  move_t killer_b = killer[KMT(node->ply, 1)];
+  move_t killer_a = ctx->killer[KMT(node->ply, 0)];
+  move_t killer_b = ctx->killer[KMT(node->ply, 1)];
 
 
   // sortable_move_t move_list
   //
   // Contains a list of possible moves at this node. These moves are "sortable"
   //   and can be compared as integers. This is accomplished by using high-order
-  //   bits to store a sort key.
+  //   bits to store a sort key.  The moves are generated in stages (see
+  //   moveStager), so that a cut-off saves generating the rest of them.
   //
   // Keep track of the number of moves that we have considered at this node.
   //   After we finish searching moves at this node the move_list array will
@@ -134,28 +162,28 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
   //
   //   m0, m1, ... , m_k-1, m_k, ... , m_N-1
   //
-  //  where k = num_moves_tried, and N = num_of_moves
+  //  where k = num_moves_tried, and N = stager.num_of_moves
   //
   //  This will allow us to update the best_move_history table easily by
   //  scanning move_list from index 0 to k such that we update the table
   //  only for moves that we actually considered at this node.
   sortable_move_t move_list[MAX_NUM_MOVES];
-  int num_of_moves = get_sortable_move_list(node, move_list, hash_table_move);
+  moveStager stager;
+  init_move_stager(&stager, node, move_list, hash_table_move,
+                   node->quiescence, ctx);
   int num_moves_tried = 0;
 
   // Start searching moves.
-  for (int mv_index = 0; mv_index < num_of_moves; mv_index++) {
-    // Incrementally sort the move list.
-    sort_incremental(move_list, num_of_moves, mv_index);
-
+  for (int mv_index = 0; has_move(node, &stager, mv_index); mv_index++) {
     move_t mv = get_move(move_list[mv_index]);
 
     num_moves_tried++;
-    (*node_count_serial)++;
+    ctx->nodes++;
 
-    moveEvaluationResult result = evaluateMove(node, mv, killer_a, killer_b,
-                                               SEARCH_PV,
-                                               node_count_serial);
+    searchNode next_node;
+    next_node.sp = node->sp;
+    moveEvaluationResult result = evaluateMove(node, &next_node, mv, killer_a,
+                                               killer_b, SEARCH_PV, ctx);
 
     if (result.type == MOVE_ILLEGAL || result.type == MOVE_IGNORE) {
       continue;
@@ -168,19 +196,20 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
     }
 
     // Check if we should abort due to time control.
-    if (abortf) {
+    if (ctx->abort) {
       return 0;
     }
 
-    bool cutoff = search_process_score(node, mv, mv_index, &result, SEARCH_PV);
+    bool cutoff = search_process_score(node, mv, mv_index, &result,
+                                       next_node.subpv, SEARCH_PV, ctx);
     if (cutoff) {
       break;
     }
   }
 
   if (node->quiescence == false) {
-    update_best_move_history(&(node->position), node->best_move_index,
-                             move_list, num_moves_tried);
+    update_best_move_history(&(node->sp->pos), node->best_move_index,
+                             move_list, num_moves_tried, ctx);
   }
 
   tbassert(abs(node->best_score) != -INF, "best_score = %d\n",
@@ -189,7 +218,7 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
   // Update the transposition table.
   //
   // Note: This function reads node->best_score, node->orig_alpha,
-  //   node->position.key, node->depth, node->ply, node->beta,
+  //   node->sp->pos.key, node->depth, node->ply, node->beta,
   //   node->alpha, node->subpv
   update_transposition_table(node);
 
@@ -202,64 +231,130 @@ static score_t searchPV(searchNode *node, int depth, uint64_t *node_count_serial
 // This handles scout search logic for the first level of the search tree
 // -----------------------------------------------------------------------------
 static void initialize_root_node(searchNode *node, score_t alpha, score_t beta, int depth,
-                            int ply, position_t* p) {
+                            int ply, searchPosition *sp) {
   node->type = SEARCH_ROOT;
   node->alpha = alpha;
   node->beta = beta;
   node->depth = depth;
   node->ply = ply;
-  node->position = *p;
-  node->fake_color_to_move = color_to_move_of(&(node->position));
+  node->sp = sp;
+  node->fake_color_to_move = color_to_move_of(&(sp->pos));
   node->best_score = -INF;
   node->pov = 1 - node->fake_color_to_move * 2;  // pov = 1 for White, -1 for Black
   node->abort = false;
 }
 
-score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
-                   int ply, move_t *pv, uint64_t *node_count_serial,
-                   FILE *OUT) {
-  static int num_of_moves = 0;  // number of moves in list
-  // hopefully, more than we will need
-  static sortable_move_t move_list[MAX_NUM_MOVES];
-
-  if (depth == 1) {
-    // we are at depth 1; generate all possible moves
-    num_of_moves = generate_all(p, move_list, false);
-    // shuffle the list of moves
-    for (int i = 0; i < num_of_moves; i++) {
-      int r = myrand() % num_of_moves;
-      sortable_move_t tmp = move_list[i];
-      move_list[i] = move_list[r];
-      move_list[r] = tmp;
+// Sets up the root moves of a new search of p, in an order drawn from
+// ctx->rand.
+void init_root_moves(search_context_t *ctx, position_t *p) {
+  rootMoves *root = &ctx->root;
+  sortable_move_t *move_list = root->moves;
+  int num_of_moves = generate_all(p, move_list, false);
+  // shuffle the list of moves
+  for (int i = 0; i < num_of_moves; i++) {
+    int r = rand_next(&ctx->rand) % num_of_moves;
+    sortable_move_t tmp = move_list[i];
+    move_list[i] = move_list[r];
+    move_list[r] = tmp;
+  }
+  root->num_of_moves = num_of_moves;
+  memset(root->nodes, 0, sizeof(root->nodes));
+  root->num_lines = 1;
+  root->line = 0;
+}
+
+// Keeps only those root moves that are among the n moves, if any of them is.
+void restrict_root_moves(search_context_t *ctx, const move_t *moves, int n) {
+  rootMoves *root = &ctx->root;
+  int num_kept = 0;
+  for (int i = 0; i < root->num_of_moves; i++) {
+    for (int j = 0; j < n; j++) {
+      if (get_move(root->moves[i]) == moves[j]) {
+        root->moves[num_kept++] = root->moves[i];
+        break;
+      }
+    }
+  }
+  if (num_kept > 0) {
+    root->num_of_moves = num_kept;
+  }
+}
+
+// Orders the root moves of the current line for the next search: the move at
+// best_index first, then the rest by the number of nodes below them, most
+// first.  Moves that needed a lot of work to refute are the likeliest to
+// become the best move.  The moves of the lines before stay where they are.
+static void order_root_moves(rootMoves *root, int best_index) {
+  int first = root->line;
+  sortable_move_t mv = root->moves[best_index];
+  uint64_t nodes = root->nodes[best_index];
+  for (int j = best_index; j > first; j--) {
+    root->moves[j] = root->moves[j - 1];
+    root->nodes[j] = root->nodes[j - 1];
+  }
+  root->moves[first] = mv;
+  root->nodes[first] = nodes;
+
+  for (int i = first + 2; i < root->num_of_moves; i++) {
+    mv = root->moves[i];
+    nodes = root->nodes[i];
+    int j = i;
+    for (; j > first + 1 && root->nodes[j - 1] < nodes; j--) {
+      root->moves[j] = root->moves[j - 1];
+      root->nodes[j] = root->nodes[j - 1];
     }
+    root->moves[j] = mv;
+    root->nodes[j] = nodes;
   }
+}
+
+// Searches the root moves of p within the window (alpha, beta).  If no move
+// scores above alpha, the result is an upper bound and pv is left as it was;
+// once a move scores beta or more, the search stops there and the result is a
+// lower bound.  Only the moves of the current line (see rootMoves) are
+// searched, and in multi-PV mode, the caller reports the lines.  Otherwise
+// each new best move is reported to OUT, unless OUT is NULL.
+score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
+                   int ply, move_t *pv, search_context_t *ctx, FILE *OUT) {
+  rootMoves *root = &ctx->root;
+  sortable_move_t *move_list = root->moves;
+  int num_of_moves = root->num_of_moves;
+  int best_index = root->line;
+
+  // The whole search plays its moves on this copy of p.
+  searchPosition sp;
+  init_search_position(&sp, p);
 
   searchNode rootNode;
   rootNode.parent = NULL;
-  initialize_root_node(&rootNode, alpha, beta, depth, ply, p);
+  initialize_root_node(&rootNode, alpha, beta, depth, ply, &sp);
 
+  // Every root move gets searched.
+  prefetch_children(&sp.pos, move_list, root->line, num_of_moves);
 
-  assert(rootNode.best_score == alpha);  // initial conditions
 
   searchNode next_node;
   next_node.subpv[0] = 0;
   next_node.parent = &rootNode;
+  next_node.sp = &sp;
+  undo_t undo;
 
   score_t score;
 
-  for (int mv_index = 0; mv_index < num_of_moves; mv_index++) {
+  for (int mv_index = root->line; mv_index < num_of_moves; mv_index++) {
     move_t mv = get_move(move_list[mv_index]);
 
     if (TRACE_MOVES) {
       print_move_info(mv, ply);
     }
 
-    (*node_count_serial)++;
+    uint64_t start_nodes = ctx->nodes++;
 
     // make the move.
-    victims_t x = make_move(&(rootNode.position), &(next_node.position), mv);
+    victims_t x = do_search_move(&sp, mv, &undo);
 
     if (is_KO(x)) {
+      undo_search_move(&sp, &undo);
       continue;  // not a legal move
     }
 
@@ -269,70 +364,69 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
       goto scored;
     }
 
-    if (is_repeated(&(next_node.position), rootNode.ply)) {
-      score = get_draw_score(&(next_node.position), rootNode.ply);
+    if (is_repeated(&sp)) {
+      score = get_draw_score(rootNode.ply);
       next_node.subpv[0] = 0;
       goto scored;
     }
 
-    if (mv_index == 0 || rootNode.depth == 1) {
+    if (mv_index == root->line || rootNode.depth == 1) {
       // We guess that the first move is the principle variation
-      score = -searchPV(&next_node, rootNode.depth-1, node_count_serial);
+      score = -searchPV(&next_node, rootNode.depth-1, ctx);
 
       // Check if we should abort due to time control.
-      if (abortf) {
+      if (ctx->abort) {
         return 0;
       }
     } else {
-      score = -scout_search(&next_node, rootNode.depth-1, node_count_serial);
+      score = -scout_search(&next_node, rootNode.depth-1, ctx);
 
       // Check if we should abort due to time control.
-      if (abortf) {
+      if (ctx->abort) {
         return 0;
       }
 
       // If its score exceeds the current best score,
       if (score > rootNode.alpha) {
-        score = -searchPV(&next_node, rootNode.depth-1, node_count_serial);
+        score = -searchPV(&next_node, rootNode.depth-1, ctx);
         // Check if we should abort due to time control.
-        if (abortf) {
+        if (ctx->abort) {
           return 0;
         }
       }
     }
 
   scored:
-    // only valid for the root node:
-    tbassert((score > rootNode.best_score) == (score > rootNode.alpha),
-             "score = %d, best = %d, alpha = %d\n", score, rootNode.best_score, rootNode.alpha);
+    undo_search_move(&sp, &undo);
+    root->nodes[mv_index] = ctx->nodes - start_nodes;
 
     if (score > rootNode.best_score) {
-      tbassert(score > rootNode.alpha, "score: %d, alpha: %d\n", score, rootNode.alpha);
-
       rootNode.best_score = score;
+    }
+
+    // Only a move that beats alpha has an exact score, or a lower bound
+    if (score > rootNode.alpha) {
+      best_index = mv_index;
       pv[0] = mv;
       memcpy(pv+1, next_node.subpv, sizeof(move_t) * (MAX_PLY_IN_SEARCH - 1));
       pv[MAX_PLY_IN_SEARCH - 1] = 0;
 
       // Print out based on UCI (universal chess interface)
-      double et = elapsed_time();
-      char   pvbuf[MAX_PLY_IN_SEARCH * MAX_CHARS_IN_MOVE];
-      getPV(pv, pvbuf, MAX_PLY_IN_SEARCH * MAX_CHARS_IN_MOVE);
-      if (et < 0.00001) {
-        et = 0.00001;  // hack so that we don't divide by 0
-      }
-
-      uint64_t nps = 1000 * *node_count_serial / et;
-      fprintf(OUT, "info depth %d move_no %d time (microsec) %d nodes %" PRIu64
-              " nps %" PRIu64 "\n",
-              depth, mv_index + 1, (int) (et * 1000), *node_count_serial, nps);
-      fprintf(OUT, "info score cp %d pv %s\n", score, pvbuf);
+      if (root->num_lines == 1 && OUT != NULL) {
+        double et = elapsed_time(ctx);
+        char   pvbuf[MAX_PLY_IN_SEARCH * MAX_CHARS_IN_MOVE];
+        getPV(pv, pvbuf, MAX_PLY_IN_SEARCH * MAX_CHARS_IN_MOVE);
+        if (et < 0.00001) {
+          et = 0.00001;  // hack so that we don't divide by 0
+        }
 
-      // Slide this move to the front of the move list
-      for (int j = mv_index; j > 0; j--) {
-        move_list[j] = move_list[j - 1];
+        uint64_t nps = 1000 * ctx->nodes / et;
+        fprintf(OUT, "info depth %d move_no %d time (microsec) %d nodes %"
+                PRIu64 " nps %" PRIu64 "\n",
+                depth, mv_index + 1, (int) (et * 1000), ctx->nodes, nps);
+        fprintf(OUT, "info score cp %d%s pv %s\n", score,
+                score >= rootNode.beta ? " lowerbound" : "", pvbuf);
       }
-      move_list[0] = mv;
     }
 
     // Normal alpha-beta logic: if the current score is better than what the
@@ -342,10 +436,10 @@ score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
       rootNode.alpha = score;
     }
     if (score >= rootNode.beta) {
-      tbassert(0, "score: %d, beta: %d\n", score, rootNode.beta);
       break;
     }
   }
 
+  order_root_moves(root, best_index);
   return rootNode.best_score;
 }
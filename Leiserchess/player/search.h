@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include "./move_gen.h"
+#include "./util.h"
 
 // score_t values
 #define INF 32700
@@ -18,22 +19,25 @@
 #define MAX_SCORE_VAL INT16_MAX
 
 
-/*//// Killer moves table and lookup function
+// Killer move table
 //
-#define __KMT_dim__ [MAX_PLY_IN_SEARCH][4]  // NOLINT(whitespace/braces)
+// https://chessprogramming.wikispaces.com/Killer+Move
+// https://chessprogramming.wikispaces.com/Killer+Heuristic
+//
+// FORMAT: killer[ply][id]
+#define __KMT_dim__ [MAX_PLY_IN_SEARCH*4]  // NOLINT(whitespace/braces)
 #define KMT(ply, id) (4 * ply + id)
-static move_t killer_reference __KMT_dim__;  // up to 4 killers
 
 // Best move history table and lookup function
-// Format: best_move_history[color_t][piece_t][square_t][orientation]
-#define __BMH_dim__ [2][6][ARR_SIZE][NUM_ORI]  // NOLINT(whitespace/braces)
+//
+// https://chessprogramming.wikispaces.com/History+Heuristic
+//
+// FORMAT: best_move_history[color_t][piece_t][square_t][orientation]
+#define __BMH_dim__ [2*6*ARR_SIZE*NUM_ORI]  // NOLINT(whitespace/braces)
 #define BMH(color, piece, square, ori)                             \
     (color * 6 * ARR_SIZE * NUM_ORI + piece * ARR_SIZE * NUM_ORI + \
      square * NUM_ORI + ori)
 
-static int best_move_history_reference __BMH_dim__;
-*/
-
 typedef int16_t score_t;  // Search uses "low res" values
 
 // Main search routines and helper functions
@@ -43,6 +47,23 @@ typedef enum searchType {  // different types of search
   SEARCH_SCOUT
 } searchType_t;
 
+// Ancestors of a searchPosition kept for repetition detection and the Ko rule.
+// Positions before the last zap can never repeat, so the search only carries
+// the keys back to there; this bounds how many it needs.
+#define KEY_HISTORY_SIZE 256
+
+// The search plays all moves in place on one position with do_move() and
+// takes them back with undo_move().  Next to the position it keeps the key
+// history: the keys of its ancestors, oldest first, and whether the move into
+// each of them zapped anything.  Parallel strands of the search each play on
+// their own copy.
+typedef struct searchPosition {
+  position_t pos;
+  int        num_keys;                  // number of ancestors in the history
+  uint64_t   keys[KEY_HISTORY_SIZE];    // keys of the ancestors
+  bool       zapped[KEY_HISTORY_SIZE];  // whether each ancestor has victims
+} searchPosition;
+
 typedef struct searchNode {
   struct searchNode* parent;
   searchType_t type;
@@ -58,21 +79,69 @@ typedef struct searchNode {
   bool abort;
   score_t best_score;
   int best_move_index;
-  position_t position;
+  searchPosition *sp;  // played on in place; shared with parent and children
   move_t subpv[MAX_PLY_IN_SEARCH];
 } searchNode;
 
 
+// The moves at the root of a search, kept from one iteration of iterative
+// deepening to the next: the best move of the last iteration comes first, and
+// the rest follow by the size of their subtrees in it.
+//
+// In multi-PV mode, each iteration finds the best num_lines moves, one line at
+// a time: the search of line k only searches the moves from index k on, and
+// puts its best move at index k.
+typedef struct rootMoves {
+  int num_of_moves;
+  sortable_move_t moves[MAX_NUM_MOVES];
+  uint64_t nodes[MAX_NUM_MOVES];  // nodes searched below each move
+  int num_lines;                  // best moves to find, 1 but in multi-PV mode
+  int line;                       // the line being searched
+} rootMoves;
+
+// Everything that a search writes as it goes, other than the position it
+// plays on and the transposition table: the killer and history tables, the
+// node counter, the clock and abort flag, the root moves and the random numbers
+// that order them.  Each searcher
+// owns a search_context_t and passes it down through the search, so that
+// searchers do not write to each other's tables.  The parallel strands of one
+// search share its context; their unsynchronized updates of the tables can
+// only cost move ordering.
+//
+// The node counter and the abort state are touched at every node by every
+// strand, so each sits on a cache line of its own, away from the tables.
+typedef struct search_context {
+  move_t   killer __KMT_dim__;             // up to 4 killers
+  int      best_move_history __BMH_dim__;
+  rootMoves root;
+  rand_state_t rand;  // shuffles the root moves, see init_root_moves
+  uint64_t nodes __attribute__((aligned(64)));  // nodes searched so far
+  uint64_t max_nodes;  // abort once nodes gets here, unless it is 0
+  // The clock and the stop request are set from the main thread (see
+  // leiserchess.c) while the search thread is reading them.
+  volatile double start __attribute__((aligned(64)));  // in milliseconds
+  volatile double timeout;  // time elapsed before abort
+  volatile bool   abort;    // abort flag for search
+  volatile bool   stop;     // search stopped by the user
+} __attribute__((aligned(64))) search_context_t;
+
 void init_tics();
-void init_abort_timer(double goal_time);
-double elapsed_time();
-bool should_abort();
-void reset_abort();
-void init_best_move_history();
+void init_abort_timer(search_context_t *ctx, double goal_time);
+void init_node_limit(search_context_t *ctx, uint64_t max_nodes);
+double elapsed_time(search_context_t *ctx);
+bool should_abort(search_context_t *ctx);
+void reset_abort(search_context_t *ctx);
+void stop_search(search_context_t *ctx);
+void init_stop(search_context_t *ctx);
+void init_best_move_history(search_context_t *ctx);
+void init_killers(search_context_t *ctx);
+void init_lmr_table();
 move_t get_move(sortable_move_t sortable_mv);
+void getPV(move_t *pv, char *buf, size_t bufsize);
+void init_root_moves(search_context_t *ctx, position_t *p);
+void restrict_root_moves(search_context_t *ctx, const move_t *moves, int n);
 score_t searchRoot(position_t *p, score_t alpha, score_t beta, int depth,
-                   int ply, move_t *pv, uint64_t *node_count_serial,
-                   FILE *OUT);
+                   int ply, move_t *pv, search_context_t *ctx, FILE *OUT);
 
 
 #endif  // SEARCH_H
@@ -1,10 +1,8 @@
 // Copyright (c) 2015 MIT License by 6.172 Staff
 
-// tic counter for how often we should check for abort
-static int     tics = 0;
-static double  sstart;    // start time of a search in milliseconds
-static double  timeout;   // time elapsed before abort
-static bool    abortf = false;  // abort flag for search
+// tic counter for how often we should check for abort; each thread of the
+// search counts its own nodes, so that the counter is not shared
+static __thread int tics = 0;
 
 static score_t fmarg[10] = {
   0, PAWN_VALUE / 2, PAWN_VALUE, (PAWN_VALUE * 5) / 2, (PAWN_VALUE * 9) / 2,
@@ -12,6 +10,10 @@ static score_t fmarg[10] = {
   PAWN_VALUE * 30
 };
 
+// lmr_table[depth][n]: ply by which scout search reduces its n-th legal move
+// at depth.  Filled in by init_lmr_table() from the lmr_* options.
+static int lmr_table[LMR_DEPTHS][MAX_NUM_MOVES + 1];
+
 typedef enum {
     MOVE_EVALUATED,
     MOVE_ILLEGAL,
@@ -22,7 +24,6 @@ typedef enum {
 typedef struct moveEvaluationResult {
   score_t score;
   moveEvaluationResult_t type;
-  searchNode next_node;
 } moveEvaluationResult;
 
 typedef struct leafEvalResult {
@@ -30,6 +31,7 @@ typedef struct leafEvalResult {
   moveEvaluationResult_t type;
   bool should_enter_quiescence;
   int hash_table_move;
+  score_t static_eval;  // eval() plus the having-the-move bonus
 } leafEvalResult;
 
 
@@ -51,81 +53,169 @@ static void set_sort_key(sortable_move_t *mv, sort_key_t key) {
   return;
 }
 
-void init_abort_timer(double goal_time) {
-  sstart = milliseconds();
+void init_abort_timer(search_context_t *ctx, double goal_time) {
+  ctx->start = milliseconds();
   // don't go over any more than 3 times the goal
-  timeout = sstart + goal_time * 3.0;
+  ctx->timeout = ctx->start + goal_time * 3.0;
+}
+
+// Makes the search abort after max_nodes nodes, or never for 0.
+void init_node_limit(search_context_t *ctx, uint64_t max_nodes) {
+  ctx->max_nodes = max_nodes;
+}
+
+double elapsed_time(search_context_t *ctx) {
+  return milliseconds() - ctx->start;
+}
+
+bool should_abort(search_context_t *ctx) {
+  return ctx->abort;
 }
 
-double elapsed_time() {
-  return milliseconds() - sstart;
+// A stop holds for the rest of the search, also across iterations.
+void reset_abort(search_context_t *ctx) {
+  ctx->abort = ctx->stop;
 }
 
-bool should_abort() {
-  return abortf;
+// Makes the search abort as soon as possible; it can be called from any thread.
+void stop_search(search_context_t *ctx) {
+  ctx->stop = true;
+  ctx->abort = true;
 }
 
-void reset_abort() {
-  abortf = false;
+// Clears a stop before the next search.
+void init_stop(search_context_t *ctx) {
+  ctx->stop = false;
+  ctx->abort = false;
 }
 
 void init_tics() {
   tics = 0;
 }
 
+// From depth 3 on, late moves are reduced by 1 ply from the LMR_R1-th on, by 2
+// from the LMR_R2-th on, and by LMR_SCALE percent of ln(depth) * ln(n) more,
+// down to a quiescence search at the least.
+void init_lmr_table() {
+  for (int depth = 0; depth < LMR_DEPTHS; depth++) {
+    for (int n = 0; n <= MAX_NUM_MOVES; n++) {
+      int r = 0;
+      if (depth > 2 && n >= LMR_R1) {
+        r = (n >= LMR_R2) ? 2 : 1;
+        r += (int) (log(depth) * log(n) * LMR_SCALE / 100);
+        if (r > depth - 1) {
+          r = depth - 1;
+        }
+      }
+      lmr_table[depth][n] = r;
+    }
+  }
+}
+
 move_t get_move(sortable_move_t sortable_mv) {
   return (move_t) (sortable_mv & MOVE_MASK);
 }
 
-static score_t get_draw_score(position_t *p, int ply) {
-  position_t *x = p->history;
-  uint64_t cur = p->key;
-  score_t score;
-  while (true) {
-    if (!zero_victims(x->victims)) {
-      break;  // cannot be a repetition
-    }
-    x = x->history;
-    if (!zero_victims(x->victims)) {
-      break;  // cannot be a repetition
+// Sets up sp to search p, whose ancestors are reached through p->history.
+static void init_search_position(searchPosition *sp, position_t *p) {
+  position_t *ancestors[KEY_HISTORY_SIZE];
+  int n = 0;
+
+  // Walk back to the last zap, but keep at least the two ancestors that the
+  // Ko rule looks at.  Leave room for the moves of the search itself.
+  for (position_t *x = p->history;
+       x != NULL && n < KEY_HISTORY_SIZE - MAX_PLY_IN_SEARCH; x = x->history) {
+    ancestors[n++] = x;
+    if (n >= 2 && !zero_victims(x->victims)) {
+      break;
     }
-    if (x->key == cur) {  // is a repetition
-      if (ply & 1) {
-        score = -DRAW;
-      } else {
-        score = DRAW;
-      }
-      return score;
-    }
-    x = x->history;
   }
-  assert(false);  // This should not occur.
-  return (score_t) 0;
+
+  sp->pos = *p;
+  init_pawn_ev(&sp->pos);  // in case the evaluation options have changed
+  sp->num_keys = n;
+  for (int i = 0; i < n; i++) {
+    sp->keys[i] = ancestors[n - 1 - i]->key;
+    sp->zapped[i] = !zero_victims(ancestors[n - 1 - i]->victims);
+  }
+}
+
+#if PARALLEL
+// Copies src into dst for another strand of the search.  Only the part of the
+// key history that can still matter is copied.
+static void fork_search_position(searchPosition *dst, searchPosition *src) {
+  int first = src->num_keys - 1;
+  while (first > 0 && !src->zapped[first]) {
+    first--;
+  }
+  if (first > src->num_keys - 2) {
+    first = src->num_keys - 2;
+  }
+  if (first < 0) {
+    first = 0;
+  }
+
+  dst->pos = src->pos;
+  dst->num_keys = src->num_keys - first;
+  memcpy(dst->keys, src->keys + first, sizeof(uint64_t) * dst->num_keys);
+  memcpy(dst->zapped, src->zapped + first, sizeof(bool) * dst->num_keys);
+}
+#endif
+
+// Plays mv on sp and returns its victims, or KO if the move breaks the Ko
+// rule.  Must be followed by undo_search_move() with the same *u either way.
+static victims_t do_search_move(searchPosition *sp, move_t mv, undo_t *u) {
+  tbassert(sp->num_keys < KEY_HISTORY_SIZE, "num_keys: %d\n", sp->num_keys);
+  sp->keys[sp->num_keys] = sp->pos.key;
+  sp->zapped[sp->num_keys] = !zero_victims(sp->pos.victims);
+  sp->num_keys++;
+
+  STATS_START(move_start);
+  victims_t victims = do_move(&(sp->pos), mv, u);
+  STATS_STOP(move_start, make_move_ticks);
+
+  // The other half of the Ko rule (see do_move): no move may bring back the
+  // position from before the opponent's last move.
+  if (USE_KO && !is_KO(victims) && sp->num_keys >= 2 &&
+      sp->pos.key == sp->keys[sp->num_keys - 2]) {
+    return KO();
+  }
+  return victims;
+}
+
+static void undo_search_move(searchPosition *sp, undo_t *u) {
+  undo_move(&(sp->pos), u);
+  sp->num_keys--;
+}
+
+static score_t get_draw_score(int ply) {
+  score_t score;
+  if (ply & 1) {
+    score = -DRAW;
+  } else {
+    score = DRAW;
+  }
+  return score;
 }
 
 
 
 // Detect move repetition
-static bool is_repeated(position_t *p, int ply) {
+static bool is_repeated(searchPosition *sp) {
   if (!DETECT_DRAWS) {
     return false;  // no draw detected
   }
 
-  position_t *x = p->history;
-  uint64_t cur = p->key;
+  uint64_t cur = sp->pos.key;
 
-  while (true) {
-    if (!zero_victims(x->victims)) {
-      break;  // cannot be a repetition
-    }
-    x = x->history;
-    if (!zero_victims(x->victims)) {
+  // Only every other ancestor has the same side to move.
+  for (int i = sp->num_keys - 1; i >= 1; i -= 2) {
+    if (sp->zapped[i] || sp->zapped[i - 1]) {
       break;  // cannot be a repetition
     }
-    if (x->key == cur) {  // is a repetition
+    if (sp->keys[i - 1] == cur) {  // is a repetition
       return true;
     }
-    x = x->history;
   }
   return false;
 }
@@ -158,7 +248,7 @@ static score_t get_game_over_score(victims_t victims, int pov, int ply) {
   return score;
 }
 
-static void getPV(move_t *pv, char *buf, size_t bufsize) {
+void getPV(move_t *pv, char *buf, size_t bufsize) {
   buf[0] = 0;
 
   for (int i = 0; i < (MAX_PLY_IN_SEARCH - 1) && pv[i] != 0; i++) {
@@ -190,13 +280,17 @@ leafEvalResult evaluate_as_leaf(searchNode *node, searchType_t type) {
   result.score = -INF;
   result.should_enter_quiescence = false;
   result.hash_table_move = 0;
+  result.static_eval = -INF;
 
   // get transposition table record if available.
   //
   // https://chessprogramming.wikispaces.com/Transposition+Table
-  ttRec_t *rec = tt_hashtable_get(node->position.key);
+  STATS_INC(tt_probes);
+  ttRec_t *rec = tt_hashtable_get(node->sp->pos.key);
   if (rec) {
+    STATS_INC(tt_hits);
     if (type == SEARCH_SCOUT && tt_is_usable(rec, node->depth, node->beta)) {
+      STATS_INC(tt_cutoffs);
       result.type = MOVE_EVALUATED;
       result.score = tt_adjust_score_from_hashtable(rec, node->ply);
       return result;
@@ -204,10 +298,29 @@ leafEvalResult evaluate_as_leaf(searchNode *node, searchType_t type) {
     result.hash_table_move = tt_move_of(rec);
   }
 
+  // endgame tablebase: the exact value, as if the position were searched to
+  // the end.  A win in d ply is scored like a zap of the King d - 1 ply on.
+  tb_value_t tb_value;
+  if (USE_TB && tb_probe(&(node->sp->pos), &tb_value)) {
+    STATS_INC(tb_hits);
+    result.type = MOVE_EVALUATED;
+    if (tb_value == TB_DRAW) {
+      result.score = get_draw_score(node->ply);
+    } else if (tb_value > 0) {
+      result.score = WIN - (node->ply + tb_value - 1);
+    } else {
+      result.score = -WIN + (node->ply - tb_value - 1);
+    }
+    return result;
+  }
+
   // stand pat (having-the-move) bonus
   //
   // https://chessprogramming.wikispaces.com/Quiescence+Search#StandPat
-  score_t sps = eval(&(node->position), false) + HMB;
+  STATS_START(eval_start);
+  score_t sps = eval(&(node->sp->pos), false) + HMB;
+  STATS_STOP(eval_start, eval_ticks);
+  result.static_eval = sps;
   bool quiescence = (node->depth <= 0);  // are we in quiescence?
   result.should_enter_quiescence = quiescence;
   if (quiescence) {
@@ -247,19 +360,18 @@ leafEvalResult evaluate_as_leaf(searchNode *node, searchType_t type) {
   return result;
 }
 
-// Evaluate the move by performing a search.
-moveEvaluationResult evaluateMove(searchNode *node, move_t mv, move_t killer_a,
-                                  move_t killer_b, searchType_t type,
-                                  uint64_t *node_count_serial) {
+// Evaluate a move that has just been played on next_node->sp by performing a
+// search.
+static moveEvaluationResult evaluate_played_move(searchNode *node,
+                                                 searchNode *next_node,
+                                                 move_t mv, victims_t victims,
+                                                 move_t killer_a,
+                                                 move_t killer_b,
+                                                 searchType_t type,
+                                                 search_context_t *ctx) {
   int ext = 0;  // extensions
   bool blunder = false;  // shoot our own piece
   moveEvaluationResult result;
-  result.next_node.subpv[0] = 0;
-  result.next_node.parent = node;
-
-  // Make the move, and get any victim pieces.
-  victims_t victims = make_move(&(node->position), &(result.next_node.position),
-                                mv);
 
   // Check whether this move changes the board state (moves that don't are
   // illegal).
@@ -283,9 +395,9 @@ moveEvaluationResult evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   }
 
   // Check whether the board state has been repeated, this results in a draw.
-  if (is_repeated(&(result.next_node.position), node->ply)) {
+  if (is_repeated(next_node->sp)) {
     result.type = MOVE_GAMEOVER;
-    result.score = get_draw_score(&(result.next_node.position), node->ply);
+    result.score = get_draw_score(node->ply);
     return result;
   }
 
@@ -318,13 +430,10 @@ moveEvaluationResult evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   //
   // https://chessprogramming.wikispaces.com/Late+Move+Reductions
   int next_reduction = 0;
-  if (type == SEARCH_SCOUT && node->legal_move_count + 1 >= LMR_R1 && node->depth > 2 &&
-      zero_victims(victims) && mv != killer_a && mv != killer_b) {
-    if (node->legal_move_count + 1 >= LMR_R2) {
-      next_reduction = 2;
-    } else {
-      next_reduction = 1;
-    }
+  if (type == SEARCH_SCOUT && zero_victims(victims) && mv != killer_a &&
+      mv != killer_b) {
+    int depth = node->depth < LMR_DEPTHS ? node->depth : LMR_DEPTHS - 1;
+    next_reduction = lmr_table[depth][node->legal_move_count + 1];
   }
 
   result.type = MOVE_EVALUATED;
@@ -335,18 +444,19 @@ moveEvaluationResult evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   // After a reduced-depth search, a full-depth search will be performed if the
   //  reduced-depth search did not trigger a cut-off.
   if (next_reduction > 0) {
+    STATS_INC(lmr_tries);
     search_depth -= next_reduction;
-    int reduced_depth_score = -scout_search(&(result.next_node), search_depth,
-                                            node_count_serial);
+    int reduced_depth_score = -scout_search(next_node, search_depth, ctx);
     if (reduced_depth_score < node->beta) {
       result.score = reduced_depth_score;
       return result;
     }
+    STATS_INC(lmr_researches);
     search_depth += next_reduction;
   }
 
   // Check if we should abort due to time control.
-  if (abortf) {
+  if (ctx->abort) {
     result.score = 0;
     result.type = MOVE_IGNORE;
     return result;
@@ -354,16 +464,14 @@ moveEvaluationResult evaluateMove(searchNode *node, move_t mv, move_t killer_a,
 
 
   if (type == SEARCH_SCOUT) {
-    result.score = -scout_search(&(result.next_node), search_depth,
-                                 node_count_serial);
+    result.score = -scout_search(next_node, search_depth, ctx);
   } else {
     if (node->legal_move_count == 0 || node->quiescence) {
-      result.score = -searchPV(&(result.next_node), search_depth, node_count_serial);
+      result.score = -searchPV(next_node, search_depth, ctx);
     } else {
-      result.score = -scout_search(&(result.next_node), search_depth,
-                            node_count_serial);
+      result.score = -scout_search(next_node, search_depth, ctx);
       if (result.score > node->alpha) {
-        result.score = -searchPV(&(result.next_node), node->depth + ext - 1, node_count_serial);
+        result.score = -searchPV(next_node, node->depth + ext - 1, ctx);
       }
     }
   }
@@ -371,9 +479,73 @@ moveEvaluationResult evaluateMove(searchNode *node, move_t mv, move_t killer_a,
   return result;
 }
 
-// Incremental sort of the move list.
-void sort_incremental(sortable_move_t *move_list, int num_of_moves, int mv_index) {
-  for (int j = 0; j < num_of_moves; j++) {
+// Prefetches the transposition table entries of the positions that moves
+// [begin, end) of move_list lead to from p, for moves that zap nothing.  The
+// loads all overlap, so this suits a list of moves that is about to be
+// searched as a whole.
+static void prefetch_children(position_t *p, sortable_move_t *move_list,
+                              int begin, int end) {
+  uint64_t keys[MAX_NUM_MOVES];
+  int n = 0;
+  for (int i = begin; i < end; i++) {
+    keys[n++] = key_after_move(p, get_move(move_list[i]));
+  }
+  tt_prefetch_batch(keys, n);
+}
+
+// Evaluate the move by performing a search.  The move is played on
+// next_node->sp, which must hold the position of node, and taken back
+// afterwards.
+moveEvaluationResult evaluateMove(searchNode *node, searchNode *next_node,
+                                  move_t mv, move_t killer_a, move_t killer_b,
+                                  searchType_t type, search_context_t *ctx) {
+  next_node->subpv[0] = 0;
+  next_node->parent = node;
+
+  // Fetch the transposition table entries of the next position while the
+  // move is played.  Its key can be told in advance unless the move zaps
+  // something, and in quiescence, only such moves are searched: there, the
+  // fetch starts once the move is played.
+  if (!node->quiescence) {
+    tt_prefetch(key_after_move(&(next_node->sp->pos), mv));
+  }
+
+  // Make the move, and get any victim pieces.
+  undo_t undo;
+  victims_t victims = do_search_move(next_node->sp, mv, &undo);
+  if (victim_exists(victims)) {
+    tt_prefetch(next_node->sp->pos.key);
+  }
+
+  moveEvaluationResult result =
+      evaluate_played_move(node, next_node, mv, victims, killer_a, killer_b,
+                           type, ctx);
+
+  undo_search_move(next_node->sp, &undo);
+  return result;
+}
+
+// Brings the best of move_list[mv_index..num_of_moves) to mv_index.  A
+// sortable move compares by its sort key first and by its move bits next, so
+// picking moves one at a time yields the same order as sort_moves().
+//
+// https://chessprogramming.wikispaces.com/Move+Ordering#Selection
+static void select_move(sortable_move_t *move_list, int num_of_moves,
+                        int mv_index) {
+  int best = mv_index;
+  for (int j = mv_index + 1; j < num_of_moves; j++) {
+    if (move_list[j] > move_list[best]) {
+      best = j;
+    }
+  }
+  sortable_move_t tmp = move_list[mv_index];
+  move_list[mv_index] = move_list[best];
+  move_list[best] = tmp;
+}
+
+// Insertion sort of the move list, best move first.
+static void sort_moves(sortable_move_t *move_list, int num_of_moves) {
+  for (int j = 1; j < num_of_moves; j++) {
     sortable_move_t insert = move_list[j];
     int hole = j;
     while (hole > 0 && insert > move_list[hole-1]) {
@@ -386,14 +558,15 @@ void sort_incremental(sortable_move_t *move_list, int num_of_moves, int mv_index
 
 // Returns true if a cutoff was triggered, false otherwise.
 bool search_process_score(searchNode *node, move_t mv, int mv_index,
-                                moveEvaluationResult *result, searchType_t type) {
+                          moveEvaluationResult *result, move_t *next_subpv,
+                          searchType_t type, search_context_t *ctx) {
   if (result->score > node->best_score) {
     node->best_score = result->score;
     node->best_move_index = mv_index;
     node->subpv[0] = mv;
 
     // write best move into right position in PV buffer.
-    memcpy(node->subpv + 1, result->next_node.subpv,
+    memcpy(node->subpv + 1, next_subpv,
            sizeof(move_t) * (MAX_PLY_IN_SEARCH - 1));
     node->subpv[MAX_PLY_IN_SEARCH - 1] = 0;
 
@@ -402,6 +575,11 @@ bool search_process_score(searchNode *node, move_t mv, int mv_index,
     }
 
     if (result->score >= node->beta) {
+      STATS_INC(cutoffs);
+      if (mv_index == 0) {
+        STATS_INC(first_move_cutoffs);
+      }
+      move_t *killer = ctx->killer;
       if (mv != killer[KMT(node->ply, 0)] && ENABLE_TABLES) {
         killer[KMT(node->ply, 1)] = killer[KMT(node->ply, 0)];
         killer[KMT(node->ply, 0)] = mv;
@@ -413,50 +591,189 @@ bool search_process_score(searchNode *node, move_t mv, int mv_index,
 }
 
 // Check if we should abort.
-bool should_abort_check() {
+bool should_abort_check(search_context_t *ctx) {
+  if (ctx->max_nodes != 0 && ctx->nodes >= ctx->max_nodes) {
+    ctx->abort = true;
+    return true;
+  }
   tics++;
   if ((tics & ABORT_CHECK_PERIOD) == 0) {
-    if (milliseconds() >= timeout) {
-      abortf = true;
+    if (milliseconds() >= ctx->timeout) {
+      ctx->abort = true;
       return true;
     }
   }
   return false;
 }
 
-// Obtain a sorted move list.
+// Stages of move generation at a search node.  The moves of a stage are only
+// generated once the search gets to it, so a cut-off in an early stage saves
+// generating the rest, and quiescence never generates the quiet moves.
+//
+// https://chessprogramming.wikispaces.com/Move+Generation#Staged
+typedef enum {
+  STAGE_HASH,      // the hash table move
+  STAGE_CAPTURES,  // moves that might zap a piece
+  STAGE_KILLERS,   // killer moves that are not captures
+  STAGE_QUIETS,    // all other moves
+  STAGE_DONE
+} moveStage_t;
+
+// number of moves of a stage that has_move() picks before sorting the rest
+#define NUM_PICKED_MOVES 3
+
+typedef struct moveStager {
+  moveStage_t      stage;          // next stage to generate
+  bool             captures_only;  // stop after the captures (quiescence)
+  move_t           hash_move;      // 0 unless the hash move was generated
+  move_t           killer_a;
+  move_t           killer_b;
+  const int       *history;        // best move history of the search
+  bitboard_t       capture_sqs;    // see capture_squares()
+  sortable_move_t *move_list;      // moves generated so far
+  int              num_of_moves;
+  int              stage_start;    // index of the first move of the stage
+  int              num_selected;   // the first num_selected are in order
+} moveStager;
+
+static void init_move_stager(moveStager *st, searchNode *node,
+                             sortable_move_t *move_list, int hash_table_move,
+                             bool captures_only, search_context_t *ctx) {
+  st->stage = STAGE_HASH;
+  st->captures_only = captures_only;
+  st->hash_move = hash_table_move;
+  st->killer_a = ctx->killer[KMT(node->ply, 0)];
+  st->killer_b = ctx->killer[KMT(node->ply, 1)];
+  st->history = ctx->best_move_history;
+  st->capture_sqs = capture_squares(&(node->sp->pos));
+  st->move_list = move_list;
+  st->num_of_moves = 0;
+  st->stage_start = 0;
+  st->num_selected = 0;
+}
+
+static bool is_capture_move(moveStager *st, move_t mv) {
+  return ((bb_of(from_square(mv)) | bb_of(to_square(mv))) &
+          st->capture_sqs) != 0;
+}
+
+// Sets the sort keys of the n moves of a stage in list.  Moves that an earlier
+// stage already produced are dropped.  Returns the number of moves left.
 //
 // https://chessprogramming.wikispaces.com/Move+Ordering
-static int get_sortable_move_list(searchNode *node, sortable_move_t * move_list,
-                         int hash_table_move) {
-  // number of moves in list
-  int num_of_moves = generate_all(&(node->position), move_list, false);
-
-  color_t fake_color_to_move = color_to_move_of(&(node->position));
-
-  move_t killer_a = killer[KMT(node->ply, 0)];
-  move_t killer_b = killer[KMT(node->ply, 1)];
-
-  // sort special moves to the front
-  for (int mv_index = 0; mv_index < num_of_moves; mv_index++) {
-    move_t mv = get_move(move_list[mv_index]);
-    if (mv == hash_table_move) {
-      set_sort_key(&move_list[mv_index], SORT_MASK);
-    } else if (mv == killer_a) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 1);
-    } else if (mv == killer_b) {
-      set_sort_key(&move_list[mv_index], SORT_MASK - 2);
+static int order_stage(searchNode *node, moveStager *st, sortable_move_t *list,
+                       int n, bool drop_killers) {
+  position_t *p = &(node->sp->pos);
+  color_t fake_color_to_move = color_to_move_of(p);
+  int num_kept = 0;
+
+  for (int i = 0; i < n; i++) {
+    sortable_move_t smv = list[i];
+    move_t mv = get_move(smv);
+    if (mv == st->hash_move) {
+      continue;
+    } else if (mv == st->killer_a || mv == st->killer_b) {
+      if (drop_killers) {
+        continue;
+      }
+      set_sort_key(&smv, mv == st->killer_a ? SORT_MASK - 1 : SORT_MASK - 2);
     } else {
       ptype_t  pce = ptype_mv_of(mv);
       rot_t    ro  = rot_of(mv);   // rotation
       square_t fs  = from_square(mv);
-      int      ot  = ORI_MASK & (ori_of(node->position.board[fs]) + ro);
+      int      ot  = ORI_MASK & (ori_of(p->board[fs]) + ro);
       square_t ts  = to_square(mv);
-      set_sort_key(&move_list[mv_index],
-                   best_move_history[BMH(fake_color_to_move, pce, ts, ot)]);
+      set_sort_key(&smv,
+                   st->history[BMH(fake_color_to_move, pce, ts, ot)]);
     }
+    list[num_kept++] = smv;
   }
-  return num_of_moves;
+  return num_kept;
 }
 
+// Appends the moves of the next stage to the move list.
+static void next_move_stage(searchNode *node, moveStager *st) {
+  position_t *p = &(node->sp->pos);
+  sortable_move_t *list = st->move_list + st->num_of_moves;
+  int n = 0;
+
+  st->stage_start = st->num_of_moves;
+  switch (st->stage) {
+    case STAGE_HASH:
+      if (st->hash_move != 0 && is_pseudo_legal(p, st->hash_move) &&
+          (!st->captures_only || is_capture_move(st, st->hash_move))) {
+        list[n++] = st->hash_move;
+        set_sort_key(&list[0], SORT_MASK);
+      } else {
+        st->hash_move = 0;
+      }
+      st->stage = STAGE_CAPTURES;
+      break;
+    case STAGE_CAPTURES:
+      n = order_stage(node, st, list, generate_captures(p, list), false);
+      st->stage = st->captures_only ? STAGE_DONE : STAGE_KILLERS;
+      break;
+    case STAGE_KILLERS:
+      if (st->killer_a != 0 && st->killer_a != st->hash_move &&
+          is_pseudo_legal(p, st->killer_a) &&
+          !is_capture_move(st, st->killer_a)) {
+        list[n] = st->killer_a;
+        set_sort_key(&list[n++], SORT_MASK - 1);
+      }
+      if (st->killer_b != 0 && st->killer_b != st->hash_move &&
+          is_pseudo_legal(p, st->killer_b) &&
+          !is_capture_move(st, st->killer_b)) {
+        list[n] = st->killer_b;
+        set_sort_key(&list[n++], SORT_MASK - 2);
+      }
+      st->stage = STAGE_QUIETS;
+      break;
+    case STAGE_QUIETS:
+      n = order_stage(node, st, list, generate_quiets(p, list), true);
+      st->stage = STAGE_DONE;
+      break;
+    case STAGE_DONE:
+    default:
+      break;
+  }
 
+  st->num_of_moves += n;
+  tbassert(st->num_of_moves <= MAX_NUM_MOVES,
+           "num_of_moves: %d\n", st->num_of_moves);
+}
+
+// Whether the node has a move with index mv_index, generating the next stages
+// of moves and ordering them as needed.  The search asks for the moves in
+// order, so the moves not yet in order all belong to the latest stage.
+//
+// Most cut-offs come from one of the first few moves of a stage, so these are
+// picked one at a time.  A node that gets past them is likely to search the
+// whole stage, and then sorting the rest at once is cheaper.
+static bool has_move(searchNode *node, moveStager *st, int mv_index) {
+  while (mv_index >= st->num_of_moves && st->stage != STAGE_DONE) {
+    STATS_START(movegen_start);
+    next_move_stage(node, st);
+    STATS_STOP(movegen_start, movegen_ticks);
+  }
+  if (mv_index >= st->num_of_moves) {
+    return false;
+  }
+  if (mv_index >= st->num_selected) {
+    if (mv_index - st->stage_start < NUM_PICKED_MOVES) {
+      select_move(st->move_list, st->num_of_moves, mv_index);
+      st->num_selected = mv_index + 1;
+    } else {
+      sort_moves(st->move_list + mv_index, st->num_of_moves - mv_index);
+      st->num_selected = st->num_of_moves;
+    }
+  }
+  return true;
+}
+
+#if PARALLEL
+// Generates and orders all of the remaining moves of the node at once.
+static void select_all_moves(searchNode *node, moveStager *st) {
+  while (has_move(node, st, st->num_selected)) {
+  }
+}
+#endif
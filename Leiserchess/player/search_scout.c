@@ -41,20 +41,111 @@ static void initialize_scout_node(searchNode *node, int depth) {
   node->ply = node->parent->ply + 1;
   node->subpv[0] = 0;
   node->legal_move_count = 0;
-  node->fake_color_to_move = color_to_move_of(&(node->position));
+  node->fake_color_to_move = color_to_move_of(&(node->sp->pos));
   // point of view = 1 for white, -1 for black
   node->pov = 1 - node->fake_color_to_move * 2;
   node->best_move_index = 0;  // index of best move found
   node->abort = false;
 }
 
-static score_t scout_search(searchNode *node, int depth,
-                            uint64_t *node_count_serial) {
+// Searches move mv_index of the move list of scout node node, playing it on sp,
+//   and folds its score into the node.  Returns true if the move was scored,
+//   i.e., it was neither illegal nor ignored.
+//
+// Younger brothers run this in parallel, each on its own copy of the position,
+//   so the shared fields of node are only updated while holding node_mutex.
+//   Once a brother has produced a cut-off, node->abort is set and the
+//   remaining brothers return immediately.
+static bool scout_search_move(searchNode *node, searchPosition *sp,
+                              sortable_move_t *move_list, int mv_index,
+                              move_t killer_a, move_t killer_b,
+                              simple_mutex_t *node_mutex,
+                              search_context_t *ctx) {
+  if (parallel_node_aborted(node)) {
+    return false;
+  }
+
+  move_t mv = get_move(move_list[mv_index]);
+
+  if (TRACE_MOVES) {
+    print_move_info(mv, node->ply);
+  }
+
+  // increase node count
+  __sync_fetch_and_add(&ctx->nodes, 1);
+
+  searchNode next_node;
+  next_node.sp = sp;
+  moveEvaluationResult result = evaluateMove(node, &next_node, mv, killer_a,
+                                             killer_b, SEARCH_SCOUT, ctx);
+
+  if (result.type == MOVE_ILLEGAL || result.type == MOVE_IGNORE
+      || ctx->abort || parallel_parent_aborted(node)) {
+    return false;
+  }
+
+  simple_acquire(node_mutex);
+  if (!parallel_node_aborted(node)) {
+    // A legal move is a move that's not KO, but when we are in quiescence
+    // we only want to count moves that has a capture.
+    if (result.type == MOVE_EVALUATED) {
+      node->legal_move_count++;
+    }
+
+    // process the score. Note that this mutates fields in node.
+    bool cutoff = search_process_score(node, mv, mv_index, &result,
+                                       next_node.subpv, SEARCH_SCOUT, ctx);
+    if (cutoff) {
+      node->abort = true;
+    }
+  }
+  simple_release(node_mutex);
+
+  return true;
+}
+
+// Whether mv is the King's null move, which fires the laser without moving.
+static bool is_null_move(move_t mv) {
+  return from_square(mv) == to_square(mv) && rot_of(mv) == NONE;
+}
+
+// Searches the position after the side to move of node passes, reduced by r
+// ply, and returns its score for node, or -INF if it cannot pass.
+//
+// The King's null move (see generate_all) is a pass as long as its laser zaps
+// nothing.  In a real game the Ko rule forbids such a pass, but the search
+// only uses it to learn that the opponent is lost even with two moves in a row.
+static score_t null_move_search(searchNode *node, int depth, int r,
+                                search_context_t *ctx) {
+  position_t *p = &(node->sp->pos);
+  square_t ksq = p->kloc[color_to_move_of(p)];
+  move_t null_mv = move_of(KING, (rot_t) 0, ksq, ksq);
+
+  __sync_fetch_and_add(&ctx->nodes, 1);
+
+  undo_t undo;
+  do_search_move(node->sp, null_mv, &undo);
+  score_t score = -INF;
+  if (zero_victims(p->victims)) {
+    searchNode next_node;
+    next_node.parent = node;
+    next_node.sp = node->sp;
+    next_node.subpv[0] = 0;
+    score = -scout_search(&next_node, depth - 1 - r, ctx);
+  }
+  undo_search_move(node->sp, &undo);
+  return score;
+}
+
+// Searches scout node node, trying a null move first if try_null is set.
+static score_t scout_search_node(searchNode *node, int depth, bool try_null,
+                                 search_context_t *ctx) {
   // Initialize the search node.
   initialize_scout_node(node, depth);
+  STATS_NODE(depth);
 
   // check whether we should abort
-  if (should_abort_check() || parallel_parent_aborted(node)) {
+  if (should_abort_check(ctx) || parallel_parent_aborted(node)) {
     return 0;
   }
 
@@ -66,6 +157,44 @@ static score_t scout_search(searchNode *node, int depth,
     return pre_evaluation_result.score;
   }
 
+  // Null-move pruning: if the opponent cannot reach beta even when we pass, a
+  // real move will not let them either.  Zugzwang breaks this, so from
+  // NULL_VERIFY on, a cut-off is only taken after a search of the node itself
+  // to the depth of the null-move search confirms it.
+  //
+  // https://chessprogramming.wikispaces.com/Null+Move+Pruning
+  // https://chessprogramming.wikispaces.com/Verified+Null+Move+Pruning
+  if (try_null && USE_NULL && depth >= NULL_DEPTH &&
+      !pre_evaluation_result.should_enter_quiescence &&
+      pre_evaluation_result.static_eval >= node->beta &&
+      node->beta < WIN - MAX_PLY_IN_SEARCH &&
+      !is_null_move(node->sp->pos.last_move)) {
+    int r = NULL_R + (depth - NULL_DEPTH) / NULL_R_DEPTH;
+    STATS_INC(null_tries);
+    score_t null_score = null_move_search(node, depth, r, ctx);
+    if (ctx->abort || parallel_parent_aborted(node)) {
+      return 0;
+    }
+    if (null_score >= node->beta) {
+      if (depth < NULL_VERIFY) {
+        STATS_INC(null_cutoffs);
+        return node->beta;
+      }
+      searchNode verify_node;
+      verify_node.parent = node->parent;
+      verify_node.sp = node->sp;
+      score_t verify_score = scout_search_node(&verify_node, depth - r, false,
+                                               ctx);
+      if (ctx->abort || parallel_parent_aborted(node)) {
+        return 0;
+      }
+      if (verify_score >= node->beta) {
+        STATS_INC(null_cutoffs);
+        return node->beta;
+      }
+    }
+  }
+
   // Populate some of the fields of this search node, using some
   //  of the information provided by the pre-evaluation.
   int hash_table_move = pre_evaluation_result.hash_table_move;
@@ -73,78 +202,82 @@ static score_t scout_search(searchNode *node, int depth,
   node->quiescence = pre_evaluation_result.should_enter_quiescence;
 
   // Grab the killer-moves for later use.
-  move_t killer_a = killer[KMT(node->ply, 0)];
-  move_t killer_b = killer[KMT(node->ply, 1)];
+  move_t killer_a = ctx->killer[KMT(node->ply, 0)];
+  move_t killer_b = ctx->killer[KMT(node->ply, 1)];
 
-  // Store the sorted move list on the stack.
+  // Store the move list on the stack.
   //   MAX_NUM_MOVES is all that we need.
   sortable_move_t move_list[MAX_NUM_MOVES];
 
-  // Obtain the sorted move list.
-  int num_of_moves = get_sortable_move_list(node, move_list, hash_table_move);
-
-  int number_of_moves_evaluated = 0;
-
+  // The moves are generated in stages and picked best first as needed.
+  moveStager stager;
+  init_move_stager(&stager, node, move_list, hash_table_move,
+                   node->quiescence, ctx);
 
   // A simple mutex. See simple_mutex.h for implementation details.
   simple_mutex_t node_mutex;
   init_simple_mutex(&node_mutex);
 
-  // Sort the move list.
-  sort_incremental(move_list, num_of_moves, number_of_moves_evaluated);
-
-  for (int mv_index = 0; mv_index < num_of_moves; mv_index++) {
-    // Get the next move from the move list.
-    int local_index = number_of_moves_evaluated++;
-    move_t mv = get_move(move_list[local_index]);
-
-    if (TRACE_MOVES) {
-      print_move_info(mv, node->ply);
+  // Young Brothers Wait: search the eldest brother serially, and only then
+  //   its younger brothers in parallel.  Moves that turn out to be illegal or
+  //   ignored do not count as the eldest brother.
+  //
+  // https://chessprogramming.wikispaces.com/Young+Brothers+Wait+Concept
+  int mv_index = 0;
+  while (!parallel_node_aborted(node) && has_move(node, &stager, mv_index)) {
+    if (scout_search_move(node, node->sp, move_list, mv_index++, killer_a,
+                          killer_b, &node_mutex, ctx)) {
+      break;
     }
+  }
 
-    // increase node count
-    __sync_fetch_and_add(node_count_serial, 1);
-
-    moveEvaluationResult result = evaluateMove(node, mv, killer_a, killer_b,
-                                               SEARCH_SCOUT,
-                                               node_count_serial);
-
-    if (result.type == MOVE_ILLEGAL || result.type == MOVE_IGNORE
-        || abortf || parallel_parent_aborted(node)) {
-      continue;
+#if PARALLEL
+  if (USE_YBW && depth >= YBW_DEPTH && !parallel_node_aborted(node)) {
+    // The younger brothers need all of the remaining moves up front.
+    select_all_moves(node, &stager);
+    int num_of_moves = stager.num_of_moves;
+    if (!node->quiescence) {
+      prefetch_children(&(node->sp->pos), move_list, mv_index, num_of_moves);
     }
-
-    // A legal move is a move that's not KO, but when we are in quiescence
-    // we only want to count moves that has a capture.
-    if (result.type == MOVE_EVALUATED) {
-      node->legal_move_count++;
+    cilk_for (int i = mv_index; i < num_of_moves; i++) {
+      searchPosition sp;
+      fork_search_position(&sp, node->sp);
+      scout_search_move(node, &sp, move_list, i, killer_a, killer_b,
+                        &node_mutex, ctx);
     }
+    mv_index = num_of_moves;
+  }
+#endif
 
-    // process the score. Note that this mutates fields in node.
-    bool cutoff = search_process_score(node, mv, local_index, &result, SEARCH_SCOUT);
-
-    if (cutoff) {
-      node->abort = true;
-      break;
-    }
+  for (; !parallel_node_aborted(node) && has_move(node, &stager, mv_index);
+       mv_index++) {
+    scout_search_move(node, node->sp, move_list, mv_index, killer_a, killer_b,
+                      &node_mutex, ctx);
   }
 
   if (parallel_parent_aborted(node)) {
     return 0;
   }
 
+  // After a cut-off, only the moves up to the cut-off move count as tried.
+  int number_of_moves_evaluated = parallel_node_aborted(node) ?
+      node->best_move_index + 1 : stager.num_of_moves;
+
   if (node->quiescence == false) {
-    update_best_move_history(&(node->position), node->best_move_index,
-                             move_list, number_of_moves_evaluated);
+    update_best_move_history(&(node->sp->pos), node->best_move_index,
+                             move_list, number_of_moves_evaluated, ctx);
   }
 
   tbassert(abs(node->best_score) != -INF, "best_score = %d\n",
            node->best_score);
 
-  // Reads node->position.key, node->depth, node->best_score, and node->ply
+  // Reads node->sp->pos.key, node->depth, node->best_score, and node->ply
   update_transposition_table(node);
 
   return node->best_score;
 }
 
-
+static score_t scout_search(searchNode *node, int depth,
+                            search_context_t *ctx) {
+  return scout_search_node(node, depth, true, ctx);
+}
@@ -0,0 +1,114 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+#include "./stats.h"
+
+#include <string.h>
+
+#include "./util.h"
+
+#if STATS
+
+// Threads beyond this many share the last searchStats, and may lose counts.
+#define MAX_STATS_THREADS 256
+
+static searchStats stats_of[MAX_STATS_THREADS];
+static int num_stats_threads = 0;
+
+// A thread takes a searchStats afresh for each search: stats_reset() starts a
+// new generation.
+unsigned stats_generation = 1;
+__thread searchStats *stats_mine = NULL;
+__thread unsigned stats_mine_generation = 0;
+
+// When the ticks were first read, for converting them to ms
+static uint64_t base_ticks = 0;
+static double base_ms = 0;
+
+void stats_register() {
+  int i = __sync_fetch_and_add(&num_stats_threads, 1);
+  stats_mine = &stats_of[i < MAX_STATS_THREADS ? i : MAX_STATS_THREADS - 1];
+  stats_mine_generation = stats_generation;
+}
+
+// Clears the counters for a new search.  No search may be running.
+void stats_reset() {
+  memset(stats_of, 0, sizeof(stats_of));
+  num_stats_threads = 0;
+  stats_generation++;
+  if (base_ms == 0) {
+    base_ticks = stats_ticks();
+    base_ms = milliseconds();
+  }
+}
+
+static double ratio(uint64_t part, uint64_t whole) {
+  return whole > 0 ? (double) part / whole : 0;
+}
+
+// Prints the counters of the last search, summed over its threads, as one
+// line of JSON.
+void stats_print_json(FILE *out) {
+  int num_threads = num_stats_threads < MAX_STATS_THREADS ?
+      num_stats_threads : MAX_STATS_THREADS;
+
+  // searchStats is all counters, so they add up word by word.
+  searchStats total;
+  memset(&total, 0, sizeof(total));
+  for (int t = 0; t < num_threads; t++) {
+    uint64_t *sum = (uint64_t *) &total;
+    uint64_t *add = (uint64_t *) &stats_of[t];
+    for (size_t i = 0; i < sizeof(searchStats) / sizeof(uint64_t); i++) {
+      sum[i] += add[i];
+    }
+  }
+
+  double elapsed_ms = milliseconds() - base_ms;
+  double ticks_per_ms = elapsed_ms > 0 ?
+      (stats_ticks() - base_ticks) / elapsed_ms : 1;
+
+  fprintf(out, "{\"threads\": %d, \"nodes\": %" PRIu64
+          ", \"qnodes\": %" PRIu64 ", \"qnode_rate\": %.3f",
+          num_threads, total.nodes, total.qnodes,
+          ratio(total.qnodes, total.nodes));
+
+  fprintf(out, ", \"nodes_per_thread\": [");
+  for (int t = 0; t < num_threads; t++) {
+    fprintf(out, "%s%" PRIu64, t > 0 ? ", " : "", stats_of[t].nodes);
+  }
+
+  // nodes by depth, up to the deepest one reached
+  int depths = STATS_DEPTHS;
+  while (depths > 1 && total.nodes_at_depth[depths - 1] == 0) {
+    depths--;
+  }
+  fprintf(out, "], \"nodes_at_depth\": [");
+  for (int d = 1; d < depths; d++) {
+    fprintf(out, "%s%" PRIu64, d > 1 ? ", " : "", total.nodes_at_depth[d]);
+  }
+
+  fprintf(out, "], \"tt\": {\"probes\": %" PRIu64 ", \"hits\": %" PRIu64
+          ", \"cutoffs\": %" PRIu64 ", \"hit_rate\": %.3f"
+          ", \"cutoff_rate\": %.3f}",
+          total.tt_probes, total.tt_hits, total.tt_cutoffs,
+          ratio(total.tt_hits, total.tt_probes),
+          ratio(total.tt_cutoffs, total.tt_probes));
+  fprintf(out, ", \"tb_hits\": %" PRIu64, total.tb_hits);
+  fprintf(out, ", \"cutoffs\": {\"total\": %" PRIu64 ", \"first_move\": %"
+          PRIu64 ", \"first_move_rate\": %.3f}",
+          total.cutoffs, total.first_move_cutoffs,
+          ratio(total.first_move_cutoffs, total.cutoffs));
+  fprintf(out, ", \"null\": {\"tries\": %" PRIu64 ", \"cutoffs\": %" PRIu64
+          ", \"cutoff_rate\": %.3f}",
+          total.null_tries, total.null_cutoffs,
+          ratio(total.null_cutoffs, total.null_tries));
+  fprintf(out, ", \"lmr\": {\"tries\": %" PRIu64 ", \"researches\": %" PRIu64
+          ", \"research_rate\": %.3f}",
+          total.lmr_tries, total.lmr_researches,
+          ratio(total.lmr_researches, total.lmr_tries));
+  fprintf(out, ", \"time_ms\": {\"eval\": %.1f, \"movegen\": %.1f"
+          ", \"make_move\": %.1f}}\n",
+          total.eval_ticks / ticks_per_ms, total.movegen_ticks / ticks_per_ms,
+          total.make_move_ticks / ticks_per_ms);
+}
+
+#endif  // STATS
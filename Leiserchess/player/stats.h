@@ -0,0 +1,96 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Search statistics: counters of where the nodes and the time of a search go.
+// They cost nothing unless the engine is built with STATS set (make STATS=1);
+// then the search bumps them through the macros below, every thread in a
+// searchStats of its own.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef STATS
+#define STATS 0
+#endif
+
+// nodes_at_depth counts nodes by remaining depth up to here; deeper nodes
+// count in its last entry.
+#define STATS_DEPTHS 32
+
+typedef struct searchStats {
+  uint64_t nodes;               // nodes searched, quiescence included
+  uint64_t qnodes;              // ... of which in quiescence
+  uint64_t nodes_at_depth[STATS_DEPTHS];  // main search nodes by depth
+  uint64_t tt_probes;
+  uint64_t tt_hits;             // probes that found a record
+  uint64_t tt_cutoffs;          // hits whose score ended the node
+  uint64_t tb_hits;             // positions scored by a tablebase
+  uint64_t cutoffs;             // beta cut-offs
+  uint64_t first_move_cutoffs;  // ... by the first move of the node
+  uint64_t null_tries;          // null-move searches
+  uint64_t null_cutoffs;        // ... that cut the node off
+  uint64_t lmr_tries;           // moves searched at reduced depth
+  uint64_t lmr_researches;      // ... that had to be searched again
+  uint64_t eval_ticks;          // time in eval()
+  uint64_t movegen_ticks;       // time generating and ordering moves
+  uint64_t make_move_ticks;     // time playing moves
+} __attribute__((aligned(64))) searchStats;
+
+#if STATS
+
+extern __thread searchStats *stats_mine;
+extern __thread unsigned stats_mine_generation;
+extern unsigned stats_generation;
+
+void stats_register();
+void stats_reset();
+void stats_print_json(FILE *out);
+
+// The counters of the calling thread for the current search
+static inline searchStats *stats_of_thread() {
+  if (stats_mine_generation != stats_generation) {
+    stats_register();
+  }
+  return stats_mine;
+}
+
+// A fast clock in arbitrary units; stats_print_json() converts to ms.
+static inline uint64_t stats_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+}
+
+// Counts a node with depth left to search.
+static inline void stats_count_node(int depth) {
+  searchStats *s = stats_of_thread();
+  s->nodes++;
+  if (depth <= 0) {
+    s->qnodes++;
+  } else {
+    s->nodes_at_depth[depth < STATS_DEPTHS ? depth : STATS_DEPTHS - 1]++;
+  }
+}
+
+#define STATS_INC(field) (stats_of_thread()->field++)
+#define STATS_NODE(depth) stats_count_node(depth)
+#define STATS_START(t) uint64_t t = stats_ticks()
+#define STATS_STOP(t, field) (stats_of_thread()->field += stats_ticks() - (t))
+
+#else
+
+#define STATS_INC(field)
+#define STATS_NODE(depth)
+#define STATS_START(t)
+#define STATS_STOP(t, field)
+
+#endif  // STATS
+
+#endif  // STATS_H
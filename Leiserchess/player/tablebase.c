@@ -0,0 +1,233 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Endgame tablebases.  Like the opening book, the tables are memory-mapped, so
+// only the pages that probes touch are ever read from disk.  A probe costs an
+// index computation and one byte load.
+
+#include "./tablebase.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./tbassert.h"
+
+typedef struct tb_map {
+  void *map;                // the mapped file, or NULL
+  size_t map_size;
+  const tb_value_t *table;  // its values
+} tb_map_t;
+
+// The tables by number of White and of Black Pawns
+static tb_map_t tb_maps[TB_MAX_PAWNS + 1][TB_MAX_PAWNS + 1];
+
+uint64_t tb_num_entries(const int num_pawns[2]) {
+  uint64_t n = 2;
+  for (int i = 0; i < 2 + num_pawns[WHITE] + num_pawns[BLACK]; i++) {
+    n *= TB_PIECE_STATES;
+  }
+  return n;
+}
+
+// The name of the table file, e.g., "kpk.tb"
+void tb_file_name(const int num_pawns[2], char *buf, size_t bufsize) {
+  char name[2 * TB_MAX_PAWNS + 6];
+  int n = 0;
+  for (color_t c = WHITE; c <= BLACK; c++) {
+    name[n++] = 'k';
+    for (int i = 0; i < num_pawns[c]; i++) {
+      name[n++] = 'p';
+    }
+  }
+  strcpy(name + n, ".tb");
+  snprintf(buf, bufsize, "%s", name);
+}
+
+static inline uint64_t add_piece(uint64_t index, position_t *p, square_t sq) {
+  return index * TB_PIECE_STATES + bb_index(sq) * NUM_ORI +
+      ori_of(p->board[sq]);
+}
+
+static uint64_t add_pawns(uint64_t index, position_t *p, color_t c) {
+  for (bitboard_t pawns = p->bb_ptype[PAWN] & p->bb_color[c]; pawns;
+       pawns &= pawns - 1) {
+    index = add_piece(index, p, bb_square(bb_lsb(pawns)));
+  }
+  return index;
+}
+
+// The index of p in the table of its balance of Pawns
+uint64_t tb_index(position_t *p) {
+  uint64_t index = add_piece(0, p, p->kloc[WHITE]);
+  index = add_piece(index, p, p->kloc[BLACK]);
+  index = add_pawns(index, p, WHITE);
+  index = add_pawns(index, p, BLACK);
+  return index * 2 + color_to_move_of(p);
+}
+
+// Sets up in p the position with the given index.  Returns false if the index
+// names no position.  The position has no history and no last move, and only
+// the first half of the Ko rule (see do_move) applies to it.
+bool tb_position(const int num_pawns[2], uint64_t index, position_t *p) {
+  int num_pieces = 2 + num_pawns[WHITE] + num_pawns[BLACK];
+  int states[2 + 2 * TB_MAX_PAWNS];
+  int ply = index % 2;
+  index /= 2;
+  for (int i = num_pieces - 1; i >= 0; i--) {
+    states[i] = index % TB_PIECE_STATES;
+    index /= TB_PIECE_STATES;
+  }
+
+  for (int i = 0; i < ARR_SIZE; i++) {
+    p->board[i] = 0;
+    set_ptype(&p->board[i], INVALID);
+  }
+  for (fil_t f = 0; f < BOARD_WIDTH; f++) {
+    for (rnk_t r = 0; r < BOARD_WIDTH; r++) {
+      p->board[square_of(f, r)] = 0;  // EMPTY
+    }
+  }
+
+  for (int i = 0; i < num_pieces; i++) {
+    square_t sq = bb_square(states[i] / NUM_ORI);
+    if (ptype_of(p->board[sq]) != EMPTY) {
+      return false;
+    }
+    color_t c;
+    ptype_t typ;
+    if (i < 2) {
+      c = (color_t) i;
+      typ = KING;
+      p->kloc[c] = sq;
+    } else {
+      c = (i < 2 + num_pawns[WHITE]) ? WHITE : BLACK;
+      typ = PAWN;
+      // Pawns of one color must come by increasing square
+      bool first = (i == 2 || i == 2 + num_pawns[WHITE]);
+      if (!first && states[i] / NUM_ORI <= states[i - 1] / NUM_ORI) {
+        return false;
+      }
+    }
+    set_ptype(&p->board[sq], typ);
+    set_color(&p->board[sq], c);
+    set_ori(&p->board[sq], states[i] % NUM_ORI);
+  }
+
+  p->history = NULL;
+  p->ply = ply;
+  p->last_move = 0;
+  p->victims.zapped_count = 0;
+  init_bitboards(p);
+  init_lasers(p);
+  p->key = compute_zob_key(p);
+  return true;
+}
+
+// Opens all of the tables in directory dir, in place of the current ones.
+// Returns the number of tables opened.
+int tb_open(const char *dir) {
+  tb_close();
+
+  int opened = 0;
+  int num_pawns[2];
+  for (num_pawns[WHITE] = 0; num_pawns[WHITE] <= TB_MAX_PAWNS;
+       num_pawns[WHITE]++) {
+    for (num_pawns[BLACK] = 0;
+         num_pawns[WHITE] + num_pawns[BLACK] <= TB_MAX_PAWNS;
+         num_pawns[BLACK]++) {
+      char name[32];
+      char filename[4096];
+      tb_file_name(num_pawns, name, sizeof(name));
+      snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+
+      int fd = open(filename, O_RDONLY);
+      if (fd < 0) {
+        continue;
+      }
+      struct stat sbuf;
+      if (fstat(fd, &sbuf) != 0 || sbuf.st_size < sizeof(tb_header_t)) {
+        close(fd);
+        continue;
+      }
+      void *map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      close(fd);
+      if (map == MAP_FAILED) {
+        continue;
+      }
+
+      const tb_header_t *header = (const tb_header_t *) map;
+      uint64_t n = tb_num_entries(num_pawns);
+      if (memcmp(header->magic, TB_MAGIC, sizeof(TB_MAGIC)) != 0 ||
+          header->board_width != BOARD_WIDTH ||
+          header->num_pawns[WHITE] != num_pawns[WHITE] ||
+          header->num_pawns[BLACK] != num_pawns[BLACK] ||
+          header->num_entries != n ||
+          sbuf.st_size != sizeof(tb_header_t) + n * sizeof(tb_value_t)) {
+        munmap(map, sbuf.st_size);
+        continue;
+      }
+
+      tb_map_t *m = &tb_maps[num_pawns[WHITE]][num_pawns[BLACK]];
+      m->map = map;
+      m->map_size = sbuf.st_size;
+      m->table = (const tb_value_t *) (header + 1);
+      opened++;
+    }
+  }
+  return opened;
+}
+
+void tb_close() {
+  for (int w = 0; w <= TB_MAX_PAWNS; w++) {
+    for (int b = 0; b <= TB_MAX_PAWNS; b++) {
+      tb_map_t *m = &tb_maps[w][b];
+      if (m->map != NULL) {
+        munmap(m->map, m->map_size);
+      }
+      m->map = NULL;
+      m->map_size = 0;
+      m->table = NULL;
+    }
+  }
+}
+
+// Looks p up in the tables.  Returns false if no open table covers it.
+bool tb_probe(position_t *p, tb_value_t *value) {
+  bitboard_t pawns = p->bb_ptype[PAWN];
+  if (bb_popcount(pawns) > TB_MAX_PAWNS) {
+    return false;
+  }
+  const tb_value_t *table =
+      tb_maps[bb_popcount(pawns & p->bb_color[WHITE])]
+             [bb_popcount(pawns & p->bb_color[BLACK])].table;
+  if (table == NULL) {
+    return false;
+  }
+  *value = table[tb_index(p)];
+  tbassert(*value != TB_INVALID, "probe of an invalid position\n");
+  return true;
+}
+
+// Writes table, the table for num_pawns, to filename.  Returns false on error.
+bool tb_write(const char *filename, const int num_pawns[2],
+              const tb_value_t *table) {
+  tb_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TB_MAGIC, sizeof(TB_MAGIC));
+  header.board_width = BOARD_WIDTH;
+  header.num_pawns[WHITE] = num_pawns[WHITE];
+  header.num_pawns[BLACK] = num_pawns[BLACK];
+  header.num_entries = tb_num_entries(num_pawns);
+
+  FILE *f = fopen(filename, "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+      fwrite(table, sizeof(tb_value_t), header.num_entries, f) ==
+      header.num_entries;
+  return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "./move_gen.h"
+
+// Endgame tablebases cover the positions with the two Kings and at most
+// TB_MAX_PAWNS Pawns.  Each balance of Pawns has a table of its own, in a file
+// named after it: "kk.tb", "kpk.tb" for a White Pawn, "kkp.tb" for a Black
+// one, and so on.  tests/gen_tablebase builds them.
+#define TB_MAX_PAWNS 1
+
+#define TB_MAGIC "LCTB1"
+
+// A table holds the value of each position for its side to move: TB_DRAW if
+// neither side can force a zap of the other King, d > 0 if the side to move
+// zaps it in d ply, and -d if its own King is zapped in d ply.  Wins are as
+// quick and losses as slow as possible.  Indices that name no position, such
+// as two pieces on one square, hold TB_INVALID.
+typedef int8_t tb_value_t;
+
+#define TB_DRAW 0
+#define TB_INVALID INT8_MIN
+#define TB_MAX_DIST INT8_MAX
+
+// The index of a position encodes the square and the orientation of each of
+// its pieces, in the order White King, Black King, White Pawns, Black Pawns,
+// and then the side to move.  Pawns of one color go by increasing square.
+#define TB_PIECE_STATES (BOARD_WIDTH * BOARD_WIDTH * NUM_ORI)
+
+// A tablebase file is a tb_header_t followed by the num_entries values of its
+// table.
+typedef struct tb_header {
+  char     magic[8];      // TB_MAGIC
+  int32_t  board_width;   // BOARD_WIDTH when it was written
+  int32_t  num_pawns[2];  // Pawns of each color
+  uint64_t num_entries;
+} tb_header_t;
+
+int tb_open(const char *dir);
+void tb_close();
+bool tb_probe(position_t *p, tb_value_t *value);
+
+uint64_t tb_num_entries(const int num_pawns[2]);
+void tb_file_name(const int num_pawns[2], char *buf, size_t bufsize);
+uint64_t tb_index(position_t *p);
+bool tb_position(const int num_pawns[2], uint64_t index, position_t *p);
+bool tb_write(const char *filename, const int num_pawns[2],
+              const tb_value_t *table);
+
+#endif  // TABLEBASE_H
@@ -8,6 +8,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <cilk/cilk.h>
 #include "./tbassert.h"
 
 int HASH;     // hash table size in MBytes
@@ -16,22 +18,38 @@ int USE_TT;   // Use the transposition table.
 
 // the actual record that holds the data for the transposition
 // typedef to be ttRec_t in tt.h
+//
+// The move, score, quality, bound and age are packed into one 64-bit data
+// word, and the record stores the hash key XOR-ed with that word.  Readers
+// and writers never lock: a record whose two words were written by different
+// threads fails the key check on lookup and is simply treated as a miss.
+//
+// https://chessprogramming.wikispaces.com/Shared+Hash+Table#Lockless
 struct ttRec {
-  uint64_t  key;
-  move_t    move;
-  score_t   score;
-  int       quality;
-  ttBound_t bound;
-  int       age;
+  uint64_t  key;    // hash key ^ data
+  uint64_t  data;   // packed fields, see below
 };
 
+#define SCORE_SHIFT 20
+#define QUALITY_SHIFT 36
+#define BOUND_SHIFT 44
+#define AGE_SHIFT 46
+#define AGE_MASK 0xff
 
-// each set is a 4-way set-associative cache and contains 4 records
-#define RECORDS_PER_SET 1
+// each set is a 4-way set-associative cache and contains 4 records, which
+// fill exactly one 64-byte cache line
+#define RECORDS_PER_SET 4
 typedef struct {
   ttRec_t records[RECORDS_PER_SET];
-} ttSet_t;
+} __attribute__((aligned(64))) ttSet_t;
+
 
+// The table is mapped in whole huge pages of this size, so that most probes
+// find their page in the TLB.
+#define HUGE_PAGE_SIZE (2ULL << 20)
+
+// tt_clear_sets() hands out the table to threads in chunks of this many sets.
+#define CLEAR_CHUNK_SETS (HUGE_PAGE_SIZE / sizeof(ttSet_t))
 
 // struct def for the global transposition table
 struct ttHashtable {
@@ -39,17 +57,41 @@ struct ttHashtable {
   uint64_t mask;           // a mask to map from key to set index
   unsigned age;
   ttSet_t *tt_set;         // array of sets that contains the transposition
+  size_t map_size;         // bytes mapped for tt_set
 } hashtable;  // name of the global transposition table
 
+static uint64_t pack_data(move_t move, score_t score, int quality,
+                          ttBound_t bound, unsigned age) {
+  // depth of quiescence and very deep searches is clamped to 8 bits
+  if (quality > INT8_MAX) quality = INT8_MAX;
+  if (quality < INT8_MIN) quality = INT8_MIN;
+  return ((uint64_t) (move & MOVE_MASK)) |
+      ((uint64_t) (uint16_t) score << SCORE_SHIFT) |
+      ((uint64_t) (uint8_t) quality << QUALITY_SHIFT) |
+      ((uint64_t) (bound & 3) << BOUND_SHIFT) |
+      ((uint64_t) (age & AGE_MASK) << AGE_SHIFT);
+}
+
+static int quality_of(ttRec_t *rec) {
+  return (int8_t) (rec->data >> QUALITY_SHIFT);
+}
+
+static ttBound_t bound_of(ttRec_t *rec) {
+  return (ttBound_t) ((rec->data >> BOUND_SHIFT) & 3);
+}
+
+static unsigned age_of(ttRec_t *rec) {
+  return (rec->data >> AGE_SHIFT) & AGE_MASK;
+}
 
 // getting the move out of the record
 move_t tt_move_of(ttRec_t *rec) {
-  return rec->move;
+  return rec->data & MOVE_MASK;
 }
 
 // getting the score out of the record
 score_t tt_score_of(ttRec_t *rec) {
-  return rec->score;
+  return (score_t) (uint16_t) (rec->data >> SCORE_SHIFT);
 }
 
 size_t tt_get_bytes_per_record() {
@@ -60,6 +102,65 @@ uint32_t tt_get_num_of_records() {
   return hashtable.num_of_sets * RECORDS_PER_SET;
 }
 
+// Explicit huge pages must be asked for by size: the default size may be 1GB,
+// and the kernel would round the mapping up to that, beyond what munmap() of
+// map_size later releases.
+#if defined(MAP_HUGE_SHIFT) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+// Maps size bytes of zeroed memory, a multiple of HUGE_PAGE_SIZE, for the
+// sets.  2MB huge pages that the system has set aside come first; otherwise
+// the memory is aligned to a huge page and offered to transparent huge pages.
+// Returns NULL if there is no memory.
+static ttSet_t *tt_map_sets(size_t size) {
+  void *map;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+  if (map != MAP_FAILED) {
+    return (ttSet_t *) map;
+  }
+#endif
+
+  // Over-allocate by a huge page and trim the ends to align the rest.
+  map = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  uintptr_t start = (uintptr_t) map;
+  uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  if (aligned > start) {
+    munmap(map, aligned - start);
+  }
+  munmap((void *) (aligned + size), start + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+  madvise((void *) aligned, size, MADV_HUGEPAGE);
+#endif
+  return (ttSet_t *) aligned;
+}
+
+// Zeroes all of the sets.  Under PARALLEL, the workers share the work a chunk
+// at a time; on a fresh table this also spreads its pages over the NUMA nodes
+// of the workers, since a page goes to the node that touches it first.
+static void tt_clear_sets() {
+  uint64_t num_of_chunks =
+      (hashtable.num_of_sets + CLEAR_CHUNK_SETS - 1) / CLEAR_CHUNK_SETS;
+#if PARALLEL
+  cilk_for (uint64_t i = 0; i < num_of_chunks; i++) {
+#else
+  for (uint64_t i = 0; i < num_of_chunks; i++) {
+#endif
+    uint64_t begin = i * CLEAR_CHUNK_SETS;
+    uint64_t end = begin + CLEAR_CHUNK_SETS;
+    if (end > hashtable.num_of_sets) {
+      end = hashtable.num_of_sets;
+    }
+    memset(&hashtable.tt_set[begin], 0, sizeof(ttSet_t) * (end - begin));
+  }
+}
+
 void tt_resize_hashtable(int size_in_meg) {
   uint64_t size_in_bytes = (uint64_t) size_in_meg * (1ULL << 20);
   // total number of sets we could have in the hashtable
@@ -74,16 +175,22 @@ void tt_resize_hashtable(int size_in_meg) {
   hashtable.mask = num_of_sets - 1;
   hashtable.age = 0;
 
-  free(hashtable.tt_set);  // free the old ones
-  hashtable.tt_set = (ttSet_t *) malloc(sizeof(ttSet_t) * num_of_sets);
-
+  tt_free_hashtable();  // free the old ones
+  size_t map_size = sizeof(ttSet_t) * num_of_sets;
+  map_size = (map_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  hashtable.tt_set = tt_map_sets(map_size);
   if (hashtable.tt_set == NULL) {
     fprintf(stderr,  "Hash table too big\n");
     exit(1);
   }
-
-  // might as well clear the table while we are at it
-  memset(hashtable.tt_set, 0, sizeof(ttSet_t) * hashtable.num_of_sets);
+  hashtable.map_size = map_size;
+
+  // The new memory reads as zeroes already, and a serial search might as well
+  // fault its pages in as it goes.  A parallel one clears it up front to
+  // place the pages.
+#if PARALLEL
+  tt_clear_sets();
+#endif
 }
 
 void tt_make_hashtable(int size_in_meg) {
@@ -92,8 +199,12 @@ void tt_make_hashtable(int size_in_meg) {
 }
 
 void tt_free_hashtable() {
-  free(hashtable.tt_set);
+  if (hashtable.tt_set != NULL &&
+      munmap(hashtable.tt_set, hashtable.map_size) != 0) {
+    fprintf(stderr, "Could not free the hash table.\n");
+  }
   hashtable.tt_set = NULL;
+  hashtable.map_size = 0;
 }
 
 // age the hash table by incrementing global age
@@ -102,10 +213,24 @@ void tt_age_hashtable() {
 }
 
 void tt_clear_hashtable() {
-  memset(hashtable.tt_set, 0, sizeof(ttSet_t) * hashtable.num_of_sets);
+  tt_clear_sets();
   hashtable.age = 0;
 }
 
+// Reads a record that other threads may be writing at the same time.
+static inline ttRec_t tt_read(ttRec_t *rec) {
+  ttRec_t copy;
+  copy.key = __atomic_load_n(&rec->key, __ATOMIC_RELAXED);
+  copy.data = __atomic_load_n(&rec->data, __ATOMIC_RELAXED);
+  copy.key ^= copy.data;  // recover the hash key
+  return copy;
+}
+
+static inline void tt_write(ttRec_t *rec, uint64_t key, uint64_t data) {
+  __atomic_store_n(&rec->key, key ^ data, __ATOMIC_RELAXED);
+  __atomic_store_n(&rec->data, data, __ATOMIC_RELAXED);
+}
+
 
 void tt_hashtable_put(uint64_t key, int depth, score_t score,
                       int bound_type, move_t move) {
@@ -116,51 +241,43 @@ void tt_hashtable_put(uint64_t key, int depth, score_t score,
   ttRec_t *curr_rec = hashtable.tt_set[set_index].records;
   // best record to replace that we found so far
   ttRec_t *rec_to_replace = curr_rec;
-  int replacemt_val = -99;            // value of doing the replacement
+  int replacemt_val = INT32_MAX;      // value of the record we would replace
 
   move = move & MOVE_MASK;
 
   for (int i = 0; i < RECORDS_PER_SET; i++, curr_rec++) {
-    int value = 0;  // points for sorting
+    ttRec_t rec = tt_read(curr_rec);
 
     // always use entry if it's not used or has same key
-    if (!curr_rec->key || key == curr_rec->key) {
-      if (move == 0) {
-        move = curr_rec->move;
+    if ((!rec.key && !rec.data) || key == rec.key) {
+      if (move == 0 && rec.key) {
+        move = tt_move_of(&rec);
       }
-      curr_rec->key = key;
-      curr_rec->quality = depth;
-      curr_rec->move = move;
-      curr_rec->age = hashtable.age;
-      curr_rec->score = score;
-      curr_rec->bound = (ttBound_t) bound_type;
-
-      return;
+      rec_to_replace = curr_rec;
+      break;
     }
 
-    // otherwise, potential candidate for replacement
-    if (curr_rec->age == hashtable.age) {
-      value -= 6;   // prefer not to replace if same age
-    }
-    if (curr_rec->quality < rec_to_replace->quality) {
-      value += 1;   // prefer to replace if worse quality
-    }
-    if (value > replacemt_val) {
+    // otherwise, potential candidate for replacement: prefer to replace
+    // records from earlier searches and of worse quality
+    int stale = (hashtable.age - age_of(&rec)) & AGE_MASK;
+    int value = quality_of(&rec) - 8 * stale;
+    if (value < replacemt_val) {
       replacemt_val = value;
       rec_to_replace = curr_rec;
     }
   }
   // update the record that we are replacing with this record
-  rec_to_replace->key = key;
-  rec_to_replace->quality = depth;
-  rec_to_replace->move = move;
-  rec_to_replace->age = hashtable.age;
-  rec_to_replace->score = score;
-  rec_to_replace->bound = (ttBound_t) bound_type;
+  tt_write(rec_to_replace, key,
+           pack_data(move, score, depth, (ttBound_t) bound_type,
+                     hashtable.age));
 }
 
 
+// Returns a private copy of the record for key, or NULL if there is none.
+// The copy stays valid until the calling thread's next lookup.
 ttRec_t *tt_hashtable_get(uint64_t key) {
+  static __thread ttRec_t found;
+
   if (!USE_TT) {
     return NULL;  // done if we are not using the transposition table
   }
@@ -168,13 +285,31 @@ ttRec_t *tt_hashtable_get(uint64_t key) {
   uint64_t set_index = key & hashtable.mask;
   ttRec_t *rec = hashtable.tt_set[set_index].records;
 
-  ttRec_t *found = NULL;
   for (int i = 0; i < RECORDS_PER_SET; i++, rec++) {
-    if (rec->key == key) {  // found the record that we are looking for
-      found = rec;
+    ttRec_t copy = tt_read(rec);
+    if (copy.key == key) {  // found the record that we are looking for
+      found = copy;
+      return &found;
     }
   }
-  return found;
+  return NULL;
+}
+
+
+// Starts loading the set for key into the cache without waiting for it, so
+// that a lookup of key a little later finds it there instead of in memory.
+void tt_prefetch(uint64_t key) {
+  if (USE_TT) {
+    __builtin_prefetch(&hashtable.tt_set[key & hashtable.mask]);
+  }
+}
+
+// Prefetches the sets for n keys at once, so that their loads from memory
+// overlap, e.g., for all of the positions a list of moves leads to.
+void tt_prefetch_batch(const uint64_t *keys, int n) {
+  for (int i = 0; i < n; i++) {
+    tt_prefetch(keys[i]);
+  }
 }
 
 
@@ -191,7 +326,7 @@ score_t lose_in(int ply) {
 // when you retrieve the score from the hashtable, however, you want to
 // consider the value of the position based on where you are in the search tree
 score_t tt_adjust_score_from_hashtable(ttRec_t *rec, int ply_in_search) {
-  score_t score = rec->score;
+  score_t score = tt_score_of(rec);
   if (score >= win_in(MAX_PLY_IN_SEARCH)) {
     return score - ply_in_search;
   }
@@ -217,14 +352,14 @@ score_t tt_adjust_score_for_hashtable(score_t score, int ply_in_search) {
 bool tt_is_usable(ttRec_t *tt, int depth, score_t beta) {
   // can't use this record if we are searching at depth higher than the
   // depth of this record.
-  if (tt->quality < depth) {
+  if (quality_of(tt) < depth) {
     return false;
   }
   // otherwise check whether the score falls within the bounds
-  if ((tt->bound == LOWER) && tt->score >= beta) {
+  if ((bound_of(tt) == LOWER) && tt_score_of(tt) >= beta) {
     return true;
   }
-  if ((tt->bound == UPPER) && tt->score < beta) {
+  if ((bound_of(tt) == UPPER) && tt_score_of(tt) < beta) {
     return true;
   }
 
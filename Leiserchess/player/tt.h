@@ -37,11 +37,14 @@ void tt_make_hashtable(int sizeMeg);
 void tt_resize_hashtable(int sizeInMeg);
 void tt_free_hashtable();
 void tt_age_hashtable();
+void tt_clear_hashtable();
 
 // putting / getting transposition data into / from hashtable
 void tt_hashtable_put(uint64_t key, int depth, score_t score,
                       int type, move_t move);
 ttRec_t *tt_hashtable_get(uint64_t key);
+void tt_prefetch(uint64_t key);
+void tt_prefetch_batch(const uint64_t *keys, int n);
 
 score_t tt_adjust_score_from_hashtable(ttRec_t *rec, int ply);
 score_t tt_adjust_score_for_hashtable(score_t score, int ply);
@@ -41,39 +41,57 @@ double milliseconds() {
 
 // Public domain code for JLKISS64 RNG - long period KISS RNG producing
 // 64-bit results
+
+// Sets r to the start of the sequence.
+void init_rand_state(rand_state_t *r) {
+  r->x = 123456789123ULL;
+  r->y = 987654321987ULL;
+  r->z1 = 43219876;
+  r->c1 = 6543217;
+  r->z2 = 21987643;
+  r->c2 = 1732654;
+}
+
+// The next number of the sequence of r
+uint64_t rand_next(rand_state_t *r) {
+  uint64_t t;
+
+  r->x = 1490024343005336237ULL * r->x + 123456789;
+
+  r->y ^= r->y << 21;
+  r->y ^= r->y >> 17;
+  r->y ^= r->y << 30;  // Do not set y=0!
+
+  t = 4294584393ULL * r->z1 + r->c1;
+  r->c1 = t >> 32;
+  r->z1 = t;
+
+  t = 4246477509ULL * r->z2 + r->c2;
+  r->c2 = t >> 32;
+  r->z2 = t;
+
+  return r->x + r->y + r->z1 + ((uint64_t)r->z2 << 32);  // Return 64-bit result
+}
+
+// The sequence of myrand(); not for use by more than one thread at a time
+static rand_state_t rand_state = {
+  123456789123ULL, 987654321987ULL, 43219876, 6543217, 21987643, 1732654
+};
+
 uint64_t myrand() {
   static int first_time = 0;
-  // Seed variables
-  static uint64_t x = 123456789123ULL, y = 987654321987ULL;
-  static unsigned int z1 = 43219876, c1 = 6543217, z2 = 21987643,
-      c2 = 1732654;  // Seed variables
-  static uint64_t t;
 
   if (first_time) {
     int  i;
     FILE *f = fopen("/dev/urandom", "r");
     for (i = 0; i < 64; i += 8) {
-      x = x ^ getc(f) << i;
-      y = y ^ getc(f) << i;
+      rand_state.x = rand_state.x ^ getc(f) << i;
+      rand_state.y = rand_state.y ^ getc(f) << i;
     }
 
     fclose(f);
     first_time = 0;
   }
 
-  x = 1490024343005336237ULL * x + 123456789;
-
-  y ^= y << 21;
-  y ^= y >> 17;
-  y ^= y << 30;  // Do not set y=0!
-
-  t = 4294584393ULL * z1 + c1;
-  c1 = t >> 32;
-  z1 = t;
-
-  t = 4246477509ULL * z2 + c2;
-  c2 = t >> 32;
-  z2 = t;
-
-  return x + y + z1 + ((uint64_t)z2 << 32);  // Return 64-bit result
+  return rand_next(&rand_state);
 }
@@ -34,4 +34,13 @@ void debug_log(int log_level, const char *str, ...);
 double  milliseconds();
 uint64_t myrand();
 
+// State of a random number generator like myrand(), for a thread to own
+typedef struct rand_state {
+  uint64_t     x, y;
+  unsigned int z1, c1, z2, c2;
+} rand_state_t;
+
+void init_rand_state(rand_state_t *r);
+uint64_t rand_next(rand_state_t *r);
+
 #endif  // UTIL_H
@@ -16,6 +16,7 @@
 #include <cilk/cilk.h>
 #include <cilk/reducer.h>
 
+#include "../../player/book.h"
 #include "../../player/eval.h"
 #include "../../player/fen.h"
 #include "../../player/move_gen.h"
@@ -110,8 +111,6 @@ static int_options iopts[] = {
 // Printing helpers
 // -----------------------------------------------------------------------------
 
-void getPV(move_t *pv, char *buf);
-
 int file_exists(const char *filename) {
   struct stat sbuf;
   return stat(filename, &sbuf) == 0;
@@ -172,7 +171,7 @@ static char theMove[MAX_CHARS_IN_MOVE];
 static pthread_mutex_t entry_mutex;
 //static Abort glob_abort;
 //static Speculative_add node_count_parallel;
-static uint64_t node_count_serial;
+static search_context_t search_ctx;
 
 typedef struct {
   position_t *p;
@@ -191,20 +190,20 @@ void *entry_point(void *arg) {
   double et = 0.0;
 
   // start time of search
-  init_abort_timer(tme);
+  init_abort_timer(&search_ctx, tme);
 
-  init_best_move_history();
+  init_best_move_history(&search_ctx);
   tt_age_hashtable();
 
   init_tics();
+  init_root_moves(&search_ctx, p);
 
   for (int d = 1; d <= depth; d++) {  // Iterative deepening
-    reset_abort();
+    reset_abort(&search_ctx);
 
-    searchRoot(p, -INF, INF, d, 0, subpv, &node_count_serial,
-                OUT);
+    searchRoot(p, -INF, INF, d, 0, subpv, &search_ctx, OUT);
 
-    et = elapsed_time();
+    et = elapsed_time(&search_ctx);
 
 #if PARALLEL
     // If we haven't aborted yet, store the best move we found.  Or, if we did
@@ -220,7 +219,7 @@ void *entry_point(void *arg) {
 #else
     bestMoveSoFar = subpv[0];
 
-    if (!should_abort()) {
+    if (!should_abort(&search_ctx)) {
       // print something?
     } else {
       break;
@@ -249,7 +248,7 @@ void UciBeginSearch(position_t *p, int depth, double tme) {
 #if PARALLEL
   abort_constructor(&glob_abort, NULL);
 #else
-  node_count_serial = 0;
+  search_ctx.nodes = 0;
 #endif
 
 #if PARALLEL
@@ -439,6 +438,10 @@ int main(int argc, char *argv[]) {
 
   init_options();
   init_zob();
+  init_rand_state(&search_ctx.rand);
+  init_laser_tables();
+  init_eval_tables();
+  init_lmr_table();
 
 
   ///////////////////////////////////////////////////////////////////////////
@@ -466,6 +469,11 @@ int main(int argc, char *argv[]) {
     // progressively shorter depths maybe, or just keep searching?
     int depth = GENOPENING_DEPTH;
 
+    // every position of every line, with the move played from it
+    book_entry_t *book = (book_entry_t *)
+        malloc(sizeof(book_entry_t) * BOOKLINES * MAX_BOOKMOVES);
+    int64_t num_entries = 0;
+
     tt_make_hashtable(HASH);    // initial hash table
     int lines;
     for (lines = 0; lines < BOOKLINES; lines++) {
@@ -499,8 +507,24 @@ int main(int argc, char *argv[]) {
       }
       printf("OPEN: %s\n", opn);
       fflush(stdout);
+
+      for (int i = 0; i < MAX_BOOKMOVES; i++) {
+        book_entry_t *e = &book[num_entries++];
+        e->key = gme[i].key;
+        e->move = gme[i + 1].last_move;
+        e->weight = 1;
+      }
     }
     fprintf(stderr, "Done gen opening %d lines.\n", lines);
+
+    num_entries = book_write(BOOK_FILE, book, num_entries);
+    if (num_entries < 0) {
+      fprintf(stderr, "Cannot write the book to %s.\n", BOOK_FILE);
+    } else {
+      fprintf(stderr, "Wrote %" PRId64 " book entries to %s.\n", num_entries,
+              BOOK_FILE);
+    }
+    free(book);
   }
 #endif /* GEN_OPENINGS */
 
@@ -775,7 +799,7 @@ int main(int argc, char *argv[]) {
         if (token_count >= 2) {  // Takes a depth argument to test deeper
           depth = strtol(tok[1], (char **)NULL, 10);
         }
-        do_perft(gme, depth, 0);
+        do_perft(gme, depth, 0, false);
         continue;
       }
 
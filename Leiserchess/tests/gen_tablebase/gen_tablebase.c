@@ -0,0 +1,215 @@
+// Copyright (c) 2015 MIT License by 6.172 Staff
+
+// Builds the endgame tablebases of player/tablebase.h by retrograde analysis.
+//
+// Usage: gen_tablebase [dir [max_pawns]]
+//
+// The tables are written to dir, the current directory by default, with the
+// fewest Pawns first: a zap of a Pawn leads into a table built before.  Each
+// table is solved in passes.  Pass n finds the positions that are won in n
+// ply, i.e., that have a move into a position lost in n - 1 ply, and the
+// positions that are lost in n ply, i.e., whose every move leads into a
+// position won in fewer ply.  Zapping the other King wins in 1 ply, and
+// zapping one's own loses in 1 ply.  Whatever is left when a pass finds
+// nothing more is a draw.
+//
+// A table only knows the board and the side to move, so it obeys just the
+// first half of the Ko rule (see do_move): a move must change the board.  It
+// does not know which position came before the last move, nor which positions
+// occurred earlier in the game, so it ignores the second half of the Ko rule
+// and draws by repetition.
+//
+// The table with n Pawns has 2 * 256^(n + 2) entries, and every pass visits
+// each unsolved position.  The Kings alone take a second; with one Pawn, a
+// table has 32M positions and takes 10 to 15 minutes on one core.
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#include <cilk/cilk.h>
+
+#include "../../player/eval.h"
+#include "../../player/move_gen.h"
+#include "../../player/search.h"
+#include "../../player/tablebase.h"
+#include "../../player/tbassert.h"
+
+// defined in move_gen.c
+extern int USE_KO;
+
+// The longest win or loss in the tables built so far
+static int max_dist = 0;
+
+// The value of the position index of table in pass n, or TB_DRAW if it is not
+// known yet.  Values of n ply or more are not used: they either have not been
+// found yet, or they were found in this pass.
+static tb_value_t solve_position(const int num_pawns[2],
+                                 const tb_value_t *table, uint64_t index,
+                                 int n) {
+  position_t p;
+  if (!tb_position(num_pawns, index, &p)) {
+    return TB_INVALID;
+  }
+
+  color_t c = color_to_move_of(&p);
+  sortable_move_t move_list[MAX_NUM_MOVES];
+  int num_of_moves = generate_all(&p, move_list, false);
+
+  int quickest_win = INT_MAX;
+  int slowest_loss = 0;
+  bool all_lose = true;
+  for (int i = 0; i < num_of_moves; i++) {
+    undo_t undo;
+    victims_t victims = do_move(&p, get_move(move_list[i]), &undo);
+
+    int dist = 0;  // win in dist ply if positive, loss in -dist if negative
+    if (is_KO(victims)) {
+      undo_move(&p, &undo);
+      continue;
+    }
+    if (victim_exists(victims) &&
+        ptype_of(victims.zapped[victims.zapped_count - 1]) == KING) {
+      // the laser halts on a King, so it is the last victim
+      color_t loser = color_of(victims.zapped[victims.zapped_count - 1]);
+      dist = (loser == c) ? -1 : 1;
+    } else {
+      tb_value_t v;
+      if (zero_victims(victims)) {
+        v = table[tb_index(&p)];
+      } else if (!tb_probe(&p, &v)) {
+        tbassert(false, "no table for the position after a zap\n");
+        v = TB_DRAW;
+      }
+      if (v != TB_DRAW && abs(v) < n) {
+        dist = (v < 0) ? 1 - v : -(v + 1);
+      }
+    }
+    undo_move(&p, &undo);
+
+    if (dist > 0) {
+      quickest_win = (dist < quickest_win) ? dist : quickest_win;
+    } else if (dist < 0) {
+      slowest_loss = (-dist > slowest_loss) ? -dist : slowest_loss;
+    } else {
+      all_lose = false;
+    }
+  }
+
+  if (quickest_win != INT_MAX) {
+    return quickest_win;
+  }
+  if (all_lose && slowest_loss > 0) {
+    return -slowest_loss;
+  }
+  return TB_DRAW;
+}
+
+// Solves entry index of table in pass n, if it is still open, and counts it in
+// *found if it is solved now.
+static void solve_entry(const int num_pawns[2], tb_value_t *table,
+                        uint64_t index, int n, uint64_t *found) {
+  if (table[index] != TB_DRAW) {
+    return;
+  }
+  tb_value_t v = solve_position(num_pawns, table, index, n);
+  if (v != TB_DRAW) {
+    table[index] = v;
+    __sync_fetch_and_add(found, 1);
+  }
+}
+
+// Builds the table for num_pawns and writes it to dir.  Returns false on error.
+static bool build_table(const char *dir, const int num_pawns[2]) {
+  char name[32];
+  char filename[4096];
+  tb_file_name(num_pawns, name, sizeof(name));
+  snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+
+  uint64_t num_entries = tb_num_entries(num_pawns);
+  tb_value_t *table = (tb_value_t *) malloc(num_entries * sizeof(tb_value_t));
+  if (table == NULL) {
+    fprintf(stderr, "%s: out of memory\n", name);
+    return false;
+  }
+
+  uint64_t num_positions = 0;
+  for (uint64_t i = 0; i < num_entries; i++) {
+    position_t p;
+    if (tb_position(num_pawns, i, &p)) {
+      table[i] = TB_DRAW;
+      num_positions++;
+    } else {
+      table[i] = TB_INVALID;
+    }
+  }
+  printf("%s: %"PRIu64" positions\n", name, num_positions);
+
+  // A value found in pass n is n, so values read during the pass are either
+  // from earlier passes or ignored.  Under PARALLEL, the entries are solved in
+  // parallel, and it does not matter which strand gets to an entry first.
+  uint64_t num_solved = 0;
+  int n;
+  for (n = 1; n <= TB_MAX_DIST; n++) {
+    uint64_t found = 0;
+#if PARALLEL
+    cilk_for (uint64_t i = 0; i < num_entries; i++) {
+      solve_entry(num_pawns, table, i, n, &found);
+    }
+#else
+    for (uint64_t i = 0; i < num_entries; i++) {
+      solve_entry(num_pawns, table, i, n, &found);
+    }
+#endif
+    num_solved += found;
+    printf("%s: pass %d, %"PRIu64" found, %"PRIu64" of %"PRIu64" solved\n",
+           name, n, found, num_solved, num_positions);
+    if (found > 0) {
+      max_dist = (n > max_dist) ? n : max_dist;
+    } else if (n > max_dist) {
+      break;  // nothing left to find, not even through the smaller tables
+    }
+  }
+  if (n > TB_MAX_DIST) {
+    fprintf(stderr, "%s: wins and losses beyond %d ply are draws\n", name,
+            TB_MAX_DIST);
+  }
+
+  bool ok = tb_write(filename, num_pawns, table);
+  if (!ok) {
+    fprintf(stderr, "%s: cannot write %s\n", name, filename);
+  }
+  free(table);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  const char *dir = (argc > 1) ? argv[1] : ".";
+  int max_pawns = (argc > 2) ? atoi(argv[2]) : TB_MAX_PAWNS;
+  if (max_pawns < 0 || max_pawns > TB_MAX_PAWNS) {
+    fprintf(stderr, "max_pawns must be from 0 to %d\n", TB_MAX_PAWNS);
+    return 1;
+  }
+
+  setbuf(stdout, NULL);
+
+  init_zob();
+  init_laser_tables();
+  init_eval_tables();
+  USE_KO = 1;
+
+  for (int total = 0; total <= max_pawns; total++) {
+    for (int white = total; white >= 0; white--) {
+      int num_pawns[2] = { white, total - white };
+      if (!build_table(dir, num_pawns)) {
+        return 1;
+      }
+      tb_open(dir);  // the tables with more Pawns zap into this one
+    }
+  }
+  tb_close();
+  return 0;
+}